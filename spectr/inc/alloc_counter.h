@@ -0,0 +1,14 @@
+/**
+ * @file alloc_counter.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Счетчик выделений памяти в куче для контроля обработки кадров без выделения памяти
+ */
+
+#pragma once
+#include <cstdint>
+
+/** Количество выделений памяти (operator new) в текущем потоке с его запуска
+ *  Считается только в отладочной сборке (глобальные operator new/delete заменяются в alloc_counter.cpp),
+ *  в выпускной сборке всегда 0.
+ */
+uint64_t thread_heap_allocations();
@@ -0,0 +1,63 @@
+/**
+ * @file calibration.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Калибровка шкалы длин волн и передискретизация спектра на равномерную сетку
+ */
+
+#pragma once
+#include <utility>
+#include <vector>
+
+/** Калибровка шкалы длин волн полиномом по N точкам (позиция пикселя, длина волны)
+ *
+ *  Коэффициенты находятся методом наименьших квадратов. Степень полинома ограничивается
+ *  количеством точек минус один: 2 точки - прямая, 3 точки при степени 2 - точная парабола,
+ *  как и в прежней схеме калибровки. Полином строится по нормированной координате
+ *  t = (x - x0) / xs, чтобы система оставалась хорошо обусловленной при больших номерах пикселей.
+ */
+class WavelengthCalibration {
+public:
+    bool fit(const std::vector<std::pair<int, int>>& pts, int order);
+    void clear() { coef.clear(); }
+    bool empty() const { return coef.empty(); }
+    int order() const { return static_cast<int>(coef.size()) - 1; }
+    double rms() const { return residual; }
+    double operator()(double x) const;
+
+private:
+    std::vector<double> coef;   // коэффициенты по возрастанию степени t
+    double x0 = 0, xs = 1;      // нормировка координаты пикселя
+    double residual = 0;        // среднеквадратичное отклонение точек от полинома, нм
+};
+
+
+/** Передискретизация спектра на равномерную сетку длин волн
+ *
+ *  Значение в каждом узле сетки - линейная интерполяция между двумя соседними ячейками спектра,
+ *  в интервал длин волн которых попадает узел. Номера ячеек и веса (разреженная матрица
+ *  с двумя ненулевыми элементами в строке) строятся заново только при изменении шкалы (build),
+ *  на каждый спектр передискретизация стоит два умножения на узел сетки.
+ *  Узлы за пределами шкалы получают значение 0; узлы внутри шкалы образуют непрерывный диапазон
+ *  [covered_from(), covered_to()).
+ */
+class UniformResampler {
+public:
+    void set_grid(double from, double to, double step);
+    bool enabled() const { return count > 0; }
+    bool ready() const { return valid; }
+    int size() const { return count; }
+    double grid(int k) const { return from + step * k; }
+    void build(const double* nm, int n);
+    void reset() { valid = false; }
+    void apply(const double* in, double* out) const;
+    int covered_from() const { return cover_from; }
+    int covered_to() const { return cover_to; }
+
+private:
+    double from = 0, step = 0;
+    int count = 0;              // количество узлов сетки (0 - сетка не задана)
+    bool valid = false;         // веса построены для текущей шкалы
+    int cover_from = 0, cover_to = 0; // узлы внутри шкалы
+    std::vector<int> index;     // номер левой ячейки для узла или -1, если узел вне шкалы
+    std::vector<double> weight; // вес правой ячейки (вес левой 1 - weight)
+};
@@ -8,7 +8,11 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
 #include "ocv.h"
+#include "rawfile.h"
 
 /** Базовый класс видеозахвата
 *   + Реализует статичный метод создания объекта видеозахвата в соответсвии с параметром capture_options:source
@@ -16,13 +20,16 @@
 class Capture {
 protected:
     cv::VideoCapture cap;
+    std::mutex cap_mtx; // доступ к cap из потока захвата и из обработчиков элементов управления
     static const std::map<const std::string, long> cap_props;
+    std::atomic<uint64_t> props_changed = 0;
 public:
     static std::unique_ptr<Capture> create(cv::FileStorage& fs);
-    void set_property(std::string prop, double value);
-    double get_property(std::string prop);
-    int height();
-    int width();
+    virtual void set_property(std::string prop, double value);
+    virtual double get_property(std::string prop);
+    virtual int height();
+    virtual int width();
+    uint64_t props_version() const { return props_changed; }
     virtual void read(cv::Mat& frame) = 0;
     virtual ~Capture() = default;
 };
@@ -39,13 +46,65 @@ public:
 /** Видеозахват из папки с изображениями
  *  Имена файлов должны иметь формат img_%02d.jpg. Проигрывает файлы по кругу.
  *  Частота выдачи кадров задается параметром capture_options:FPS в файле конфигурации.
+ *  Параметры file-capture:PRELOAD и file-capture:UNTHROTTLED включают предварительную загрузку
+ *  всей серии в память и выдачу кадров без ограничения частоты.
 */
 class FileCapture : public Capture {
     int delay_ms = 1000;
     const int64_t ticks_in_ms;
     int64_t grab_time = 0;
+    bool unthrottled = false;
+    cv::Mat store;               // декодированные кадры серии, расположенные подряд
+    std::vector<cv::Mat> frames; // заголовки кадров внутри store
+    size_t pos = 0;
+    void preload(const std::vector<std::string>& files);
 
 public:   
     FileCapture(std::string path, cv::FileStorage& config);
     void read(cv::Mat& frame) override;
 };
+
+
+/** Воспроизведение записи кадров из файла *.sraw (см. rawfile.h)
+ *  Файл отображается в память, кадры выдаются без копирования - заголовком cv::Mat на данные файла.
+ *  При raw-replay:REALTIME=1 кадры выдаются с исходными интервалами, иначе - с максимальной частотой.
+ *  Проигрывает запись по кругу.
+ */
+class RawFileCapture : public Capture {
+    MappedFile file;
+    std::vector<const RawFrameHeader*> index;
+    const RawFrameHeader* current = nullptr;
+    size_t pos = 0;
+    bool realtime = true;
+    int64_t due_us = 0; // время выдачи очередного кадра по steady_clock
+
+public:
+    RawFileCapture(std::string path, cv::FileStorage& config);
+    void set_property(std::string prop, double value) override;
+    double get_property(std::string prop) override;
+    int height() override;
+    int width() override;
+    void read(cv::Mat& frame) override;
+};
+
+
+/** Синтетический источник кадров для нагрузочного тестирования и проверки точности
+ *  Кадр содержит гауссовы линии излучения в заданных позициях X (на центральной строке кадра),
+ *  наклон линий (TILT) и гауссов шум. Параметры задаются в разделе synthetic файла конфигурации.
+ *  Заранее генерируется банк из BANK кадров с разными реализациями шума, кадры выдаются из банка по кругу.
+ */
+class SyntheticCapture : public Capture {
+    std::vector<cv::Mat> bank;
+    std::vector<double> line_x;
+    size_t pos = 0;
+    bool zero_copy = false;
+    int64_t period_us = 0;
+    int64_t due_us = 0;
+
+public:
+    SyntheticCapture(cv::FileStorage& config);
+    const std::vector<double>& lines() const { return line_x; }
+    int height() override;
+    int width() override;
+    void read(cv::Mat& frame) override;
+};
@@ -0,0 +1,32 @@
+/**
+ * @file colsum.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Суммирование изображения по столбцам (основная операция расчета спектра)
+ *
+ *  Изображение обходится по строкам (row-major), суммы накапливаются в широких целочисленных
+ *  аккумуляторах по всей ширине строки; нормирование выполняет вызывающая сторона один раз в конце.
+ *  Реализация (AVX2, SSE2, NEON или скалярная) выбирается при первом вызове по возможностям процессора.
+ */
+
+#pragma once
+#include <cstdint>
+#include "ocv.h"
+
+/** Добавляет к sums суммы значений по столбцам изображения img
+ * @param img изображение глубины CV_8U или CV_16U, не более 65536 строк.
+ *        Многоканальное изображение обрабатывается как одноканальное шириной cols*channels()
+ *        (для BGR получаются суммы по каналам каждого столбца).
+ * @param sums массив из img.cols*img.channels() элементов
+ */
+void column_sum(const cv::Mat& img, uint32_t* sums);
+
+/** Скалярная эталонная реализация column_sum() */
+void column_sum_ref(const cv::Mat& img, uint32_t* sums);
+
+/** Название используемой реализации column_sum(): "avx2", "sse2", "neon" или "scalar" */
+const char* column_sum_isa();
+
+/** Сравнивает column_sum() с эталонной реализацией на случайных изображениях
+ * @return true, если результаты совпадают
+ */
+bool column_sum_selftest();
@@ -4,49 +4,96 @@
  * @brief Controller class header
  */
 #pragma once
+#include <cstdint>
+#include <iosfwd>
 #include <string>
+#include <filesystem>
 #include <memory>
 #include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "ocv.h"
 #include "model.h"
 #include "capture.h"
+#include "ratio.h"
 
 class MainWindow;
+class CaptureThread;
+class TrackSet;
 class SpectrView;
 class VideoView;
+class WaterfallView;
+class RenderLoop;
 
 /**
  *  Основной класс приложения (программный менеджер)
  *  Создает и управляет ресурсами прогарммы. Рализует рабочий цикл.
+ *
+ *  Кадры обрабатываются в потоке обработки (process_loop) с частотой камеры, а поток интерфейса
+ *  (run) обрабатывает события окна и отрисовывает виды с частотой отображения (RenderLoop).
+ *  Методы управления вызываются из потока интерфейса; изменения состояния обработки
+ *  передаются в поток обработки через post().
  */
 class Controller {
 public:
-    enum class mode { video, spectr, roi_selct };
+    enum class mode { video, spectr, waterfall, roi_selct };
     
-    Controller(const std::string& config_file);
+    /** Параметры режима без окна */
+    struct HeadlessOptions {
+        uint64_t frames = 0;   // остановка после обработки frames кадров (0 - без ограничения)
+        double seconds = 0;    // остановка через seconds секунд (0 - без ограничения)
+        std::string output;    // файл csv для спектров ("-" - стандартный вывод, пустая строка - без вывода)
+        std::ostream* data_out = nullptr; // стандартный вывод для output "-", если std::cout перенаправлен (nullptr - std::cout)
+    };
+
+    Controller(const std::string& config_file, bool headless = false);
     ~Controller();
     int run();
+    int run_headless(const HeadlessOptions& h);
     void set_mode(mode m);
     void export_spectr();
     void spectr_memset();
     void spectr_memclear();
+    void spectr_memrecall();
+    void export_history();
     void showgrid(int state);
+    void show_channels(int state);
     void set_spectr_fps(int fps);
+    void set_accumulation(Model_Spectr::accumulation mode);
+    void show_noise(int state);
+    void show_peaks(int state);
+    void set_ratio(ratio_mode mode);
+    void capture_reference(bool dark);
+    void set_correction(int state);
+    void reset_correction();
     void set_rotation(int angle);
     void reset_roi();
     void calibrate(int n);
     void reset_calibration();
     Capture& get_capture();
 
+    static const int CALIB_POINTS_MAX = 8; // максимальное количество точек калибровки
+    static constexpr double RECALL_NM_TOLERANCE = 0.01; // допустимое расхождение шкал при загрузке из хранилища, нм
+
     struct Options {
         int roi_x = 0, roi_y = 0, roi_width = 0, roi_height = 0;
         int gain = 5, exposure = 5;
         int spectr_acc_fps = 1;
-        int calib_x[3] = {-1,-1,-1};
-        int calib_v[3] = { 380, 522, 710};
+        int spectr_acc_mode = 0; // Model_Spectr::accumulation
+        int show_noise = 0;
+        int show_peaks = 0;
+        int spectr_ratio_mode = 0; // ratio_mode
+        int recall_minutes = 0;    // сколько минут назад закончился интервал чтения из хранилища
+        int correction = 0;
+        std::string dark_ref, flat_ref; // файлы опорных кадров
+        int calib_x[CALIB_POINTS_MAX] = {-1,-1,-1,-1,-1,-1,-1,-1};
+        int calib_v[CALIB_POINTS_MAX] = { 380, 522, 710, -1, -1, -1, -1, -1};
         int rotation = 0;
         int showgrid = 0;
+        int show_channels = 0;
 
         void load(std::string filename);
         void save(std::string filename);
@@ -58,23 +105,79 @@ public:
     struct GlobalOptions {
         int spectr_win_width = 800;
         int spectr_win_height = 600;
-        int calib_v[3] = { -1, -1, -1 };
+        int acc_frames_max = 1000;
+        int calib_v[CALIB_POINTS_MAX] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        int calib_order = 2;
+        double grid_from = 380, grid_to = 780, grid_step = 0; // равномерная сетка длин волн (grid_step 0 - нет)
         int gain_steps = 12;
         int gain_step_val = 5;
         int exposure_limit[2] = {-13, -1};
+        int ring_size = 4;
+        std::string ring_policy = "block";
+        int threads = 0;
+        double display_fps = 30.0;      // частота отрисовки видов, Гц
+        int ref_frames = 32;
+        int history_size = 600;         // спектров в истории для водопада (0 - без истории)
+        double peak_threshold = 5.0;    // порог обнаружения пиков в шумах над фоном
+        std::string peak_fit = "gaussian";
+        int peak_max = 64;
+        std::string library_path;       // папка библиотеки эталонов (пустая - без библиотеки)
+        std::string library_metric = "correlation";
+        int library_top = 3;
+        RatioOptions ratio;
+        std::string store_path;         // файл хранилища спектров (пустой - без записи)
+        int store_chunk_mb = 64;
+        int store_index_step = 64;
+        double recall_span = 10.0;      // длительность интервала, усредняемого кнопкой MR, с
+        int recall_max = 720;           // предел регулятора "История, мин"
+        std::string record_path;
     } glob_opt;
     
 private:
-    volatile int rotation;
+    void process_loop();
+    void process_frame(const cv::Mat& frame);
+    void post(std::function<void()> cmd);
+    void apply_posted();
+    void post_geometry();
+    void finish_reference();
+    void select_roi();
+    static void write_spectr_csv(const std::filesystem::path& path, const Model_Spectr::Snapshot& snapshot,
+                                 ratio_mode ratio, const RatioOptions& ratio_opt);
+
+    const bool headless;
     std::atomic<mode> current_mode=mode::video;
     std::string config_file;
     std::string options_file;
     std::unique_ptr<Capture> capture = nullptr;
+    std::unique_ptr<CaptureThread> grabber;
+    std::thread processing;            // поток обработки кадров
+    std::atomic<bool> stop_processing = false;
+    std::mutex post_mtx;
+    std::vector<std::function<void()>> posted, posted_run; // команды для потока обработки
+    // Состояние потока обработки (изменяется только командами post)
+    cv::Rect proc_roi;
+    int proc_rotation = 0;
+    cv::Mat rotated;                // буфер повернутого изображения (используется повторно)
+#ifndef NDEBUG
+    uint64_t frames_processed = 0, frame_allocs = 0;
+#endif
+    FrameAverager ref_avg;          // накопление опорного кадра
+    bool ref_dark = true;           // накапливается темновой кадр (иначе плоское поле)
+    // Передача результатов потока обработки потоку интерфейса
+    std::mutex handoff_mtx;
+    cv::Mat ref_result;                    // накопленный опорный кадр
+    bool ref_result_dark = true;
+    std::atomic<bool> ref_ready = false;
+    cv::Mat roi_frame;                     // кадр для выбора окна мышью
+    std::atomic<bool> roi_ready = false;
+    std::shared_ptr<RenderLoop> render;
     std::unique_ptr<MainWindow> win_main;
     std::unique_ptr<Model_Spectr> model_spectr;
+    std::unique_ptr<TrackSet> tracks;  // основной трек model_spectr и дополнительные треки из конфигурации
     std::unique_ptr<Model_Video> model_video;
     std::shared_ptr<SpectrView> view_spectr;
     std::shared_ptr<VideoView> view_video;
+    std::shared_ptr<WaterfallView> view_waterfall;
 };
 
 
@@ -0,0 +1,63 @@
+/**
+ * @file correction.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Коррекция спектра по темновому кадру и кадру плоского поля
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include "ocv.h"
+#include "projection.h"
+
+/** Накопление среднего кадра по заданному количеству кадров (для опорных кадров) */
+class FrameAverager {
+public:
+    void start(int frames);
+    void cancel() { left = 0; }
+    bool active() const { return left > 0; }
+    bool add(const cv::Mat& frame);
+    cv::Mat result() const;
+
+private:
+    cv::Mat sum;
+    int left = 0;
+    int count = 0;
+};
+
+
+/** Коррекция спектра по опорным кадрам: темновому (dark) и плоского поля (flat)
+ *
+ *  Коррекция кадра (frame - dark) / (flat - dark) выполняется не по пикселям, а по ячейкам спектра.
+ *  Вычитание темнового кадра линейно и переносится на ячейки точно: из спектра кадра вычитается спектр
+ *  темнового кадра, полученный той же проекцией окна. Плоское поле учитывается коэффициентом усиления
+ *  каждой ячейки - отношением среднего по ячейкам спектра (flat - dark) к значению в ячейке.
+ *  Спектры опорных кадров пересчитываются только при изменении окна, угла или опорных кадров,
+ *  поэтому на каждый кадр коррекция стоит O(ширины спектра).
+ *  Если размер кадра не совпадает с размером опорных кадров, коррекция не выполняется, но опорные кадры
+ *  сохраняются: при возврате к прежнему размеру кадра коррекция включается снова.
+ */
+class SpectrCorrection {
+public:
+    void set_dark(cv::Mat ref);
+    void set_flat(cv::Mat ref);
+    const cv::Mat& get_dark() const { return dark; }
+    const cv::Mat& get_flat() const { return flat; }
+    bool empty() const { return dark.empty() && flat.empty(); }
+    void prepare(cv::Size frame_size, cv::Rect roi, double angle);
+    void apply(double* luma, double* const* bgr) const;
+
+    static bool save(const std::string& path, const cv::Mat& ref);
+    static cv::Mat load(const std::string& path);
+
+private:
+    void reference_bins(const cv::Mat& ref, std::vector<double>& bins) const;
+
+    cv::Mat dark, flat;           // средние опорные кадры CV_32FC1 или CV_32FC3
+    bool valid = false;           // таблицы соответствуют текущим опорным кадрам и геометрии
+    cv::Size mismatch;            // размер кадра, не совпадающий с опорными кадрами (сообщение выведено), или пустой
+    Projection projection;        // проекция окна для опорных кадров
+    int width = 0;                // количество ячеек спектра
+    std::vector<double> offset;   // спектр темнового кадра: яркость и каналы B, G, R по width элементов
+    std::vector<double> gain;     // коэффициенты плоского поля в том же порядке
+};
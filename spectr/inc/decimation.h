@@ -0,0 +1,35 @@
+/**
+ * @file decimation.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Пирамида минимумов и максимумов для прореживания графиков
+ */
+
+#pragma once
+#include <utility>
+#include <vector>
+
+/** Пирамида минимумов и максимумов ряда значений
+ *
+ *  Уровень k хранит минимум и максимум каждого блока из 2^k соседних значений (уровень 0 - сам ряд,
+ *  он не копируется). Минимум и максимум любого диапазона считаются по блокам наибольших подходящих
+ *  уровней за O(log n), поэтому ряд любой длины сводится к парам (минимум, максимум) для заданного
+ *  количества столбцов графика за O(столбцов * log(n / столбцов)) без повторного просмотра ряда.
+ *  Построение - O(n), память - n значений; буферы используются повторно.
+ */
+class MinMaxPyramid {
+public:
+    void build(const double* y, int n);
+    int size() const { return n; }
+    double operator[](int i) const { return base[i]; }
+    double min() const { return n > 0 ? lo.back() : 0.0; }
+    double max() const { return n > 0 ? hi.back() : 0.0; }
+    void range(int from, int to, double& rmin, double& rmax) const;
+
+private:
+    const double* base = nullptr; // уровень 0 (действителен до следующего build)
+    int n = 0;
+    std::vector<double> lo, hi;   // уровни 1, 2, ... подряд
+    std::vector<int> offset;      // начало уровня k (k >= 1) в lo и hi, offset[0] не используется
+};
+
+void column_ranges(const double* x, int n, double x0, double dx, int cols, std::vector<std::pair<int, int>>& ranges);
@@ -5,15 +5,14 @@
  */
 
 #pragma once
-#include <deque>
-#include <iterator>
-#include <algorithm>
-#include <numeric>
+#include <array>
 #include "ocv.h"
 
 class FPS_Stat {
-    const int QSZ = 30;
-    std::deque<int64_t> ticks;
+    static const int QSZ = 30;
+    std::array<int64_t, QSZ> ticks{};  // кольцо меток времени последних событий
+    int first = 0;                     // индекс самой старой метки
+    int count = 0;                     // количество меток в кольце
     static double diff_ms(int64_t t1, int64_t t2) {
         return 1000.0 * (t2-t1) / cv::getTickFrequency();
     }
@@ -23,27 +22,30 @@ public:
 
     /** Уведомление о наступлении события (кадра) */
     void tick() {
-        ticks.push_back(cv::getTickCount());
-        if (ticks.size() > QSZ) {
-            ticks.pop_front();
+        ticks[(first + count) % QSZ] = cv::getTickCount();
+        if (count < QSZ) {
+            count++;
+        }
+        else {
+            first = (first + 1) % QSZ;
         }
     }
 
     /** Возращает усредненную частоту событий за поуледнюю секнду */
     double fps() {
         auto now = cv::getTickCount();
-        while (ticks.size() && diff_ms(ticks.front(), now) > 1000)
-            ticks.pop_front();
-        if (ticks.size() == 0) {
+        while (count && diff_ms(ticks[first], now) > 1000) {
+            first = (first + 1) % QSZ;
+            count--;
+        }
+        if (count == 0) {
             return 0;
         }
-        else if (ticks.size() == 1) {
-            return diff_ms(now, ticks.front());
+        else if (count == 1) {
+            return diff_ms(now, ticks[first]);
         }
-        std::vector<double> diffs;
-        diffs.reserve(ticks.size());
-        std::transform(std::next(ticks.begin()), ticks.end(), ticks.begin(), std::back_inserter(diffs),
-            [](const int64_t& t2, const int64_t t1) { return FPS_Stat::diff_ms(t1, t2);});
-        return 1000 / (std::accumulate(diffs.begin(), diffs.end(), 0.0) / diffs.size());
+        // Сумма интервалов между соседними событиями равна интервалу между первым и последним
+        const int64_t last = ticks[(first + count - 1) % QSZ];
+        return 1000 / (diff_ms(ticks[first], last) / (count - 1));
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,82 @@
+/**
+ * @file grabber.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Поток видеозахвата и кольцевой буфер кадров между захватом и обработкой
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "ocv.h"
+#include "capture.h"
+#include "rawfile.h"
+
+
+/** Кольцевой буфер кадров фиксированной ёмкости
+ *  Буферы кадров выделяются один раз при создании и далее переиспользуются:
+ *  производитель читает кадр прямо в слот кольца, потребитель забирает кадр обменом заголовков cv::Mat
+ *  (свой прежний буфер он при этом возвращает в кольцо).
+ *  Политика при переполнении:
+ *   - block - производитель ждет, пока потребитель заберет кадр;
+ *   - drop_oldest - самый старый непрочитанный кадр отбрасывается;
+ *   - keep_latest - как drop_oldest, но потребитель всегда получает самый свежий кадр, остальные отбрасываются.
+ */
+class FrameRing {
+public:
+    enum class policy { block, drop_oldest, keep_latest };
+
+    /** Счетчики кадров */
+    struct Stat {
+        uint64_t produced = 0;
+        uint64_t consumed = 0;
+        uint64_t dropped = 0;
+    };
+
+    FrameRing(size_t capacity, policy p, cv::Size frame_size, int frame_type);
+    static policy policy_from_string(const std::string& name);
+
+    cv::Mat* begin_write();
+    void end_write();
+    bool read(cv::Mat& frame, int timeout_ms);
+    void close();
+    Stat stat();
+
+private:
+    std::vector<cv::Mat> slots;
+    const policy pol;
+    size_t head = 0;   // слот самого старого непрочитанного кадра
+    size_t count = 0;  // количество непрочитанных кадров
+    bool closed = false;
+    Stat counters;
+    std::mutex mtx;
+    std::condition_variable not_empty, not_full;
+};
+
+
+/** Поток видеозахвата
+ *  Непрерывно читает кадры из Capture в кольцевой буфер FrameRing,
+ *  так что обработка и отрисовка не задерживают прием кадров от камеры.
+ *  Если задан RawRecorder, каждый принятый кадр записывается в файл вместе с параметрами захвата.
+ */
+class CaptureThread {
+public:
+    CaptureThread(Capture& capture, size_t ring_size, FrameRing::policy p,
+                  std::unique_ptr<RawRecorder> recorder = nullptr);
+    ~CaptureThread();
+    bool read(cv::Mat& frame, int timeout_ms);
+    void stop();
+    FrameRing::Stat stat();
+
+private:
+    void loop();
+    Capture& capture;
+    FrameRing ring;
+    std::unique_ptr<RawRecorder> recorder;
+    std::atomic<bool> running = true;
+    std::thread thread;
+};
@@ -3,6 +3,7 @@
  * @author Sergey Simonov (sb.simonov@gmail.com)
  * @brief Вспомогательные микрофункции
  */
+#pragma once
 #include <string>
 #include <type_traits>
 #include <cstdlib>
@@ -41,9 +42,28 @@ T load_or_default(cv::FileStorage& fs, std::string node_name, std::string param_
 }
 
 
+/** Возвращает значение параметра из узла FileStorage (например, элемента списка),
+ *  или значение по умолчанию, см. load_or_default(cv::FileStorage&, ...)
+ */
+template <typename T>
+T load_or_default(const cv::FileNode& node, std::string param_name, T default_val) {
+    cv::FileNode v = node[param_name];
+    if ( v.empty() ||
+        (std::is_integral_v<T> && !v.isInt()) ||
+        (std::is_floating_point_v<T> && !v.isReal()) ||
+        (!std::is_integral_v<T> && !std::is_floating_point_v<T> && !v.isString() )  )
+    {
+        return default_val;
+    }
+    else {
+        return static_cast<T>(v);
+    }
+}
+
+
 /** Возвращает путь папки пользователя Windows из переменной окружения USERPROFILE
  */
-std::string get_user_dir(){
+inline std::string get_user_dir(){
    const int sz = 2048;
    size_t len;
    char buf[sz];
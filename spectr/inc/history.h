@@ -0,0 +1,43 @@
+/**
+ * @file history.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief История опубликованных спектров фиксированной емкости
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "ocv.h"
+
+/** Кольцо последних capacity() спектров модели
+ *
+ *  Память выделяется один раз (при задании емкости или смене ширины спектра), дальше новый спектр
+ *  записывается на место самого старого. Строки нумеруются сквозным номером с момента последнего сброса:
+ *  действительны строки с номерами от count() - size() до count() - 1. Спектры хранятся в масштабе одного кадра
+ *  (сумма блока делится на число кадров), поэтому строки сопоставимы при смене режима накопления.
+ *  Запись выполняет производитель (push), чтение (read) возможно из любого потока: строка копируется
+ *  под блокировкой, которая удерживается только на время копирования одной строки.
+ */
+class SpectrHistory {
+public:
+    void set_capacity(int n);
+    int capacity() const { return cap; }
+    void push(const double* y, int n, double scale);
+    uint64_t count() const { return written.load(std::memory_order_acquire); }
+    uint64_t generation() const { return resets.load(std::memory_order_acquire); }
+    int width() const;
+    int size() const;
+    bool read(uint64_t index, std::vector<float>& out, double* time = nullptr) const;
+
+private:
+    void reset(int n);
+
+    int cap = 0;
+    cv::Mat rows;                 // CV_32F, cap x ширина спектра
+    std::vector<double> times;    // время записи строк, с (steady_clock)
+    std::atomic<uint64_t> written = 0;  // записано строк с последнего сброса
+    std::atomic<uint64_t> resets = 0;   // номер сброса (смена емкости или ширины спектра)
+    mutable std::mutex mtx;
+};
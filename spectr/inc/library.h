@@ -0,0 +1,71 @@
+/**
+ * @file library.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Библиотека эталонных спектров и поиск наиболее похожих эталонов
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include "ocv.h"
+#include "worker_pool.h"
+
+/** Результат сравнения спектра с эталоном */
+struct LibraryMatch {
+    const std::string* name = nullptr;  // имя эталона (принадлежит библиотеке)
+    int index = -1;                     // номер эталона в библиотеке
+    float score = 0;                    // сходство от -1 до 1
+};
+
+
+/** Библиотека эталонных спектров
+ *
+ *  Эталоны загружаются из файлов csv (формат экспорта спектра: длина волны и значение в первых двух столбцах)
+ *  и передискретизируются на равномерную сетку длин волн (UniformResampler), общую со спектрами модели.
+ *  Эталоны хранятся в одной непрерывной матрице float (строка - эталон); каждая строка нормирована
+ *  на своем диапазоне длин волн (при метрике correlation центрирована, при обеих - приведена к единичной
+ *  длине), для нее хранятся префиксные суммы значений и их квадратов.
+ *  Спектр и эталон сравниваются только на пересечении их диапазонов: узлы сетки вне шкалы спектра
+ *  или эталона не участвуют (а не считаются нулями). Сходство на пересечении - одно скалярное
+ *  произведение отрезков строк и O(1) операций по префиксным суммам. Эталоны, пересечение с которыми
+ *  меньше MIN_OVERLAP диапазона спектра, не рассматриваются. Скалярные произведения считаются SIMD-ядром
+ *  (AVX2+FMA, SSE2, NEON или скалярным, выбор при первом вызове), строки делятся на блоки
+ *  по MATCH_BLOCK_ROWS и обрабатываются на пуле потоков.
+ */
+class SpectralLibrary {
+public:
+    enum class metric {
+        correlation,  // нормированная корреляция (коэффициент Пирсона)
+        cosine        // косинус угла между спектрами
+    };
+    static const int MATCH_BLOCK_ROWS = 256;
+    static constexpr double MIN_OVERLAP = 0.5;
+
+    /** Рабочие буферы match() вызывающей стороны (используются повторно без перераспределения) */
+    struct Scratch {
+        std::vector<float> query, scores;
+        std::vector<double> sum, sum2;  // префиксные суммы нормированного спектра и квадратов
+    };
+
+    SpectralLibrary(const std::string& dir, double grid_from, double grid_to, double grid_step, metric m);
+    size_t size() const { return names.size(); }
+    int bins() const { return refs.cols; }
+    const std::string& name(int i) const { return names[i]; }
+    void match(const double* spectrum, int n, int from, int to, int k, std::vector<LibraryMatch>& out,
+               Scratch& scratch, WorkerPool* pool = nullptr) const;
+
+    static metric parse_metric(const std::string& name);
+    static const char* dot_isa();
+
+private:
+    bool load_csv(const std::string& path, std::vector<double>& nm, std::vector<double>& val) const;
+    bool normalize(float* v, int n) const;
+    static void prefix_sums(const float* v, int n, double* sum, double* sum2);
+    float similarity(double xy, double x, double y, double x2, double y2, int m) const;
+
+    cv::Mat refs;                    // CV_32F, size() x bins, непрерывная
+    cv::Mat ref_sum, ref_sum2;       // CV_64F, size() x (bins + 1): префиксные суммы строк refs и квадратов
+    std::vector<int> cover_from, cover_to; // диапазоны узлов сетки, покрытые эталонами
+    std::vector<std::string> names;
+    metric mode = metric::correlation;
+};
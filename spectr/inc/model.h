@@ -7,8 +7,21 @@
 #pragma once
 #include <memory>
 #include <mutex>
+#include <atomic>
 #include <list>
+#include <vector>
 #include "ocv.h"
+#include "projection.h"
+#include "worker_pool.h"
+#include "correction.h"
+#include "snapshot.h"
+#include "calibration.h"
+#include "peaks.h"
+#include "library.h"
+#include "decimation.h"
+#include "fps.h"
+#include "history.h"
+#include "store.h"
 
 class Model;
 
@@ -26,7 +39,6 @@ public:
     void subscribe(std::weak_ptr<ModelSubscriber> handler); 
     void unsubscribe(std::weak_ptr<ModelSubscriber> handler);
     void notify();
-    virtual const cv::Mat& get_data() = 0;
     virtual void udpate_data(cv::Mat frame) = 0;
     virtual ~Model()=default;
 protected:
@@ -34,13 +46,24 @@ protected:
 };
 
 
-/** Модель видеокадра */
+/** Модель видеокадра
+ *  Кадр копируется в снимок (SnapshotBuffer), поэтому буфер кадра источника можно сразу использовать повторно,
+ *  а вид читает снимок в другом потоке. Снимок читателям только для чтения.
+ */
 class Model_Video : public Model {
 public:
-    const cv::Mat& get_data() override;
+    struct Snapshot {
+        cv::Mat frame;
+        double fps = 0;         // частота кадров в потоке обработки
+        uint64_t version = 0;
+    };
+    typedef SnapshotBuffer<Snapshot>::Ref SnapshotRef;
+
+    SnapshotRef snapshot() const { return snapshots.read(); }
     void udpate_data(cv::Mat frame) override;
 private:
-    cv::Mat data;
+    SnapshotBuffer<Snapshot> snapshots;
+    FPS_Stat frame_fps;
 };
 
 
@@ -50,25 +73,136 @@ public:
     enum {
         row_nm,
         row_base,
+        row_std,   // стандартное отклонение яркости между кадрами в масштабе row_base
         row_mem,
-        row_bdm, // "base spectr" div "mem spectr"
+        row_red,   // спектры по каналам цвета (если включены)
+        row_green,
+        row_blue,
         data_rows
     };
 
+    /** Режим накопления спектра */
+    enum class accumulation {
+        block,   // сумма по accumulate_frames кадрам, публикуется раз в accumulate_frames кадров
+        sliding, // среднее по последним accumulate_frames кадрам, публикуется после каждого кадра
+        ema      // экспоненциальное среднее с постоянной времени accumulate_frames кадров, публикуется после каждого кадра
+    };
+
+    /** Опубликованный снимок данных */
+    struct Snapshot {
+        cv::Mat data;           // data_rows x (ширина окна)
+        cv::Mat uniform;        // data_rows x (узлов равномерной сетки) или пустая, если сетка не задана или нет калибровки
+        int covered_from = 0, covered_to = 0; // столбцы uniform внутри шкалы спектра (вне диапазона - не измерены, 0)
+        bool mem = false;       // строка row_mem действительна
+        bool channels = false;  // строки row_red, row_green, row_blue действительны
+        double scale = 1;       // количество кадров, просуммированных в row_base (в режиме block), иначе 1
+        double mem_scale = 1;   // то же для row_mem на момент сохранения
+        std::vector<Peak> peaks; // пики спектра row_base (если поиск пиков включен), по возрастанию положения
+        std::vector<LibraryMatch> matches; // наиболее похожие эталоны библиотеки (по убыванию сходства)
+        double fps = 0;         // частота обработки кадров моделью (поток обработки), а не публикации
+        uint64_t version = 0;   // номер снимка
+        // Для графиков: строятся при публикации один раз на снимок и ссылаются на его же data и noise
+        cv::Mat noise;          // 2 x (ширина окна): границы полосы шума row_base -/+ row_std
+        MinMaxPyramid lod[data_rows]; // пирамиды действительных строк data (row_base, row_mem, каналы)
+        MinMaxPyramid lod_noise[2];   // пирамиды строк noise
+    };
+    typedef SnapshotBuffer<Snapshot>::Ref SnapshotRef;
+
     Model_Spectr(std::vector<std::pair<int, int>> cpt, long accumulate_frames);
+    void set_geometry(cv::Rect roi, int angle);
     void udpate_data(cv::Mat frame) override;
-    void calibrate(const std::vector<std::pair<int, int>> &cpt);
+    void udpate_sums(const uint32_t* sums, cv::Size frame_size, int cn, cv::Rect r);
+    Projection::Target begin_projected(cv::Size frame_size);
+    void udpate_projected(cv::Size frame_size, int cn);
+    cv::Rect frame_rect(cv::Size frame_size) const;
+    int get_angle() const { return angle; }
+    void calibrate(const std::vector<std::pair<int, int>> &cpt, int order = 2);
+    void set_uniform_grid(double from, double to, double step);
     void set_acc_fps(int fps);
-    const cv::Mat& get_data() override;
+    void set_accumulation(accumulation mode);
+    SnapshotRef snapshot() const;
     void spectr_memset();
     void spectr_memclear();
+    void spectr_memload(const std::vector<double>& values);
+    void set_channels(bool state);
+    void set_pool(std::shared_ptr<WorkerPool> pool);
+    WorkerPool* get_pool() const { return pool.get(); }
+    void set_correction(bool state);
+    void set_peaks(bool state);
+    PeakTracker& get_peak_tracker() { return peak_tracker; }
+    void set_library(std::shared_ptr<const SpectralLibrary> library, int top_k);
+    SpectrCorrection& get_correction() { return correction; }
+    void set_history(int capacity) { history.set_capacity(capacity); }
+    const SpectrHistory& get_history() const { return history; }
+    void set_store(std::shared_ptr<SpectrStore> s) { store = s; }
+    static bool window_selftest();
 
 private:
+    void begin_frame(int width);
+    void end_frame(cv::Size frame_size, int cn, cv::Rect r);
+    Projection::Target projection_target(cv::Size frame_size, cv::Rect r);
+    void add_column_sums(const uint32_t* sums, int cn, int rows);
+    void reduce_columns(const cv::Mat& img);
+    static int spectr_row(int w) { return w == 0 ? row_base : row_red + w - 1; }
+    void reset_stats();
+    bool accumulate_block();
+    void accumulate_ema();
+    void reset_window();
+    void push_window();
+    void apply_calibration();
+    void apply_commands();
+    void publish_snapshot();
     std::vector<std::pair<int, int>> calibr_pts;
+    int calibr_order = 2;
+    WavelengthCalibration calibration;
+    UniformResampler resampler;  // веса передискретизации на равномерную сетку (пересчитываются в apply_calibration)
+    cv::Rect roi;
+    int angle = 0;
+    Projection projection;
+    double* proj_bgr[3] = {};  // строки каналов spectr для проекции
+    SpectrCorrection correction;
+    bool correct = false;
     int accumulate_frames = 1;
     int frames_counter = 0;
-    cv::Mat spectr, data, data_short;
+    accumulation acc_mode = accumulation::block;
+    // Скользящее окно: кольцо спектров последних кадров в фиксированной точке и их текущая сумма.
+    // Целочисленная сумма обновляется за O(1) на ячейку независимо от размера окна и не накапливает ошибку.
+    std::vector<int64_t> window;
+    std::vector<int64_t> window_sum;
+    int window_frames = 0; // размер окна (кадров)
+    int window_rows = 0;   // строк спектра в окне: яркость и, если включены, каналы R, G, B
+    int window_pos = 0;    // позиция в кольце для следующего кадра
+    int window_count = 0;  // кадров в окне (до заполнения меньше window_frames)
+    cv::Mat spectr, data;  // спектр текущего кадра, рабочая копия публикуемых данных (только для производителя)
+    cv::Mat block_sum, ema;
+    // Статистика разброса яркости по ячейкам: число кадров, среднее, сумма квадратов отклонений (в режиме ema - дисперсия)
+    int stat_n = 0;
+    std::vector<double> stat_mean, stat_m2;
+    std::vector<uint32_t> col_sums; // суммы по столбцам и каналам текущего кадра
+    std::vector<uint32_t> band_sums; // частичные суммы полос кадра при параллельной обработке
+    std::shared_ptr<WorkerPool> pool;
     bool mem_spectr = false;
-    std::mutex mtx;
+    double data_scale = 1, mem_scale = 1; // Snapshot::scale, Snapshot::mem_scale
+    bool channels = false;
+    bool find_peaks = false;
+    PeakTracker peak_tracker;  // поиск пиков в публикуемых спектрах (только производитель)
+    std::shared_ptr<const SpectralLibrary> library;
+    int library_top = 3;
+    SpectralLibrary::Scratch match_scratch;
+    SnapshotBuffer<Snapshot> snapshots;
+    FPS_Stat frame_fps;        // частота обработки кадров (Snapshot::fps)
+    SpectrHistory history;     // последние опубликованные спектры row_base (для водопада)
+    std::shared_ptr<SpectrStore> store;  // запись всех опубликованных спектров на диск (только производитель)
+    uint64_t calib_version = 0;          // увеличивается при каждом пересчете шкалы длин волн
+
+    // Команды от других потоков (интерфейса), выполняемые производителем в apply_commands()
+    enum class mem_cmd { none, set, clear, load };
+    std::atomic<bool> cmd_pending = false;
+    std::mutex cmd_mtx;
+    mem_cmd cmd_mem = mem_cmd::none;
+    std::vector<double> cmd_mem_values; // спектр для mem_cmd::load (в масштабе одного кадра)
+    bool cmd_calibrate = false;
+    std::vector<std::pair<int, int>> cmd_calibr_pts;
+    int cmd_calibr_order = 2;
 
 };
@@ -0,0 +1,74 @@
+/**
+ * @file peaks.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Поиск пиков спектра с субпиксельным уточнением и сопровождением между обновлениями
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+
+/** Пик спектра */
+struct Peak {
+    int id = 0;          // номер пика, сохраняется, пока пик сопровождается между обновлениями
+    double bin = 0;      // положение в ячейках спектра (субпиксельное)
+    double nm = 0;       // положение по шкале длин волн (заполняет модель по калибровке)
+    double height = 0;   // значение в вершине
+    double fwhm = 0;     // ширина на половине высоты над уровнем фона, ячеек
+    int age = 0;         // количество обновлений, в которых пик найден
+    int top = 0;         // ячейка вершины
+    int from = 0, to = 0; // область пика (ячейки), по которой выполнено уточнение
+    double fit_base = 0;  // уровень фона при уточнении
+    int fit_samples = 0;  // начало значений области пика при уточнении в буфере PeakTracker
+};
+
+
+/** Поиск и сопровождение пиков спектра
+ *
+ *  Уровень фона - медиана спектра, шум - робастная оценка по медиане абсолютных отклонений
+ *  разностей соседних ячеек (не зависит от формы спектра и самих пиков). Кандидаты - локальные
+ *  максимумы выше фона на threshold шумов; из близких кандидатов остается больший.
+ *  Кандидат сопоставляется с пиком предыдущего обновления в радиусе MATCH_RADIUS ячеек и получает его номер.
+ *  Если вершина пика не сместилась, а спектр в области пика и фон изменились с момента уточнения пика
+ *  меньше, чем на уровень шума, сохраняется прежнее уточнение - пересчитываются только изменившиеся области.
+ *  Сравнение идет со значениями, по которым пик уточнен, а не с предыдущим обновлением, поэтому медленный
+ *  дрейф (скользящее и экспоненциальное накопление) тоже приводит к уточнению, как только накопится.
+ */
+class PeakTracker {
+public:
+    /** Способ субпиксельного уточнения вершины */
+    enum class fit {
+        parabolic,  // парабола по трем точкам
+        gaussian,   // парабола по логарифмам трех точек (точно для гауссова профиля)
+        centroid    // центр масс области выше половины высоты
+    };
+    static const int MATCH_RADIUS = 2;
+    static const int MIN_DISTANCE = 3;  // минимальное расстояние между пиками, ячеек
+
+    void set_options(double threshold, fit method, int max_peaks);
+    static fit parse_fit(const std::string& name);
+    void reset();
+    void update(const double* y, int n);
+    const std::vector<Peak>& peaks() const { return list; }
+    double floor() const { return base; }
+    double noise() const { return sigma; }
+    int refitted() const { return refit_count; }
+
+private:
+    void estimate_floor(const double* y, int n);
+    void fit_peak(const double* y, int n, int i, Peak& p) const;
+    bool region_changed(const double* y, const Peak& p) const;
+
+    double threshold = 5.0;
+    fit method = fit::gaussian;
+    int max_peaks = 64;
+    double base = 0, sigma = 0;     // фон и шум текущего обновления
+    int refit_count = 0;            // количество пиков, уточненных заново в последнем обновлении
+    int next_id = 1;
+    int width = 0;                  // ширина спектра предыдущего обновления
+    std::vector<double> samples, next_samples; // значения областей пиков list (next) на момент их уточнения
+    std::vector<double> scratch;    // рабочий буфер для медиан
+    std::vector<int> candidates;
+    std::vector<Peak> list, next;   // пики текущего обновления и буфер для следующего
+    std::vector<char> matched;
+};
@@ -0,0 +1,66 @@
+/**
+ * @file projection.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Проекция повернутого окна кадра на ось спектра без построения повернутого изображения
+ */
+
+#pragma once
+#include <vector>
+#include "ocv.h"
+#include "worker_pool.h"
+
+/** Проекция повернутого окна (ROI) кадра на ось спектра
+ *
+ *  Результат эквивалентен повороту окна (cv::warpAffine) и усреднению полученного изображения по столбцам,
+ *  но повернутое изображение не строится: каждый пиксель исходного кадра внутри повернутого окна
+ *  распределяется между двумя соседними ячейками спектра с линейными весами.
+ *  Для каждой строки кадра заранее вычисляются диапазон пикселей внутри окна и координата первого пикселя
+ *  на оси спектра, для каждой ячейки - нормирующий коэффициент (обратная сумма весов).
+ *  Таблицы пересчитываются только при изменении размера кадра, окна или угла (setup).
+ *  Яркость вычисляется из каналов BGR по весам cv::COLOR_BGR2GRAY в том же проходе,
+ *  в нем же при необходимости получаются проекции отдельных каналов.
+ *  Кадр обрабатывается полосами по BAND_ROWS строк, при наличии пула потоков - параллельно.
+ *  Частичные суммы полос складываются в порядке номеров полос, поэтому результат не зависит от числа потоков.
+ *  Несколько окон одного кадра проецируются за один проход по кадру (project_many): в каждой полосе
+ *  обрабатываются все окна, которые ее пересекают.
+ */
+class Projection {
+public:
+    static const int BAND_ROWS = 256;
+
+    /** Окно для project_many: проекция и массивы результата (как у project) */
+    struct Target {
+        const Projection* projection;
+        double* out;
+        double* const* channels;
+    };
+
+    bool matches(cv::Size frame_size, cv::Rect roi, double angle) const;
+    void setup(cv::Size frame_size, cv::Rect roi, double angle);
+    int bins() const { return roi.width; }
+    void project(const cv::Mat& frame, double* out, double* const* channels = nullptr,
+                 WorkerPool* pool = nullptr) const;
+    static void project_many(const cv::Mat& frame, const Target* targets, size_t n, WorkerPool* pool = nullptr);
+
+private:
+    struct RowSpan {
+        int y;          // строка кадра
+        int x_from;     // первый пиксель строки внутри окна
+        int x_to;       // последний пиксель строки внутри окна
+        double u_from;  // координата пикселя x_from на оси спектра
+    };
+    template <typename T, int CN, bool WITH_CHANNELS>
+    void project_rows(const cv::Mat& frame, size_t span_from, size_t span_to, double* a) const;
+    void project_band(const cv::Mat& frame, bool with_channels, int band, double* a) const;
+    int bands() const { return spans.empty() ? 0 : static_cast<int>(band_spans.size()) - 1; }
+    void finish(double* out, double* const* channels, bool with_channels) const;
+
+    cv::Size frame_size;
+    cv::Rect roi;
+    double angle = 0;
+    double u_step = 1;  // приращение координаты на оси спектра при переходе к следующему пикселю строки
+    std::vector<RowSpan> spans;
+    std::vector<size_t> band_spans;  // индексы первых строк полос по BAND_ROWS строк кадра в spans
+    std::vector<double> norm;
+    mutable std::vector<double> acc; // для каждой полосы: яркость и каналы B, G, R по bins()+1 элементов
+};
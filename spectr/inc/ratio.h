@@ -0,0 +1,32 @@
+/**
+ * @file ratio.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Пропускание и оптическая плотность по текущему и сохраненному (опорному) спектрам
+ */
+
+#pragma once
+#include "ocv.h"
+
+/** Режим отображения спектра относительно сохраненного */
+enum class ratio_mode {
+    off,            // спектр как есть
+    transmittance,  // пропускание T = (спектр - темновой уровень) / (опорный - темновой уровень)
+    absorbance      // оптическая плотность A = -log10(T)
+};
+
+/** Параметры расчета пропускания */
+struct RatioOptions {
+    double dark_offset = 0;   // темновой уровень одного кадра (вычитается из обоих спектров)
+    double min_ref = 1.0;     // минимальный опорный сигнал одного кадра; ниже - ячейка считается непрозрачной
+    double t_max = 2.0;       // ограничение пропускания сверху
+    double a_max = 4.0;       // ограничение оптической плотности сверху (T снизу ограничивается 10^-a_max)
+};
+
+/** Расчет пропускания или оптической плотности
+ *  Считается по запросу потребителя (вида или экспорта), а не при каждом накоплении спектра.
+ * @param base текущий спектр (строка CV_64F), сумма base_scale кадров
+ * @param ref опорный спектр той же ширины, сумма ref_scale кадров
+ * @param out результат, буфер используется повторно
+ */
+void spectr_ratio(const cv::Mat& base, double base_scale, const cv::Mat& ref, double ref_scale,
+                  ratio_mode mode, const RatioOptions& opt, cv::Mat& out);
@@ -0,0 +1,88 @@
+/**
+ * @file rawfile.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Формат файла записи "сырых" кадров видеопотока (*.sraw), запись и отображение файла в память
+ *
+ *  Файл состоит из заголовка RawFileHeader и следующих за ним записей кадров.
+ *  Запись кадра - заголовок RawFrameHeader и данные кадра (строки без выравнивания),
+ *  дополненные нулями до границы RAW_ALIGN байт. Файл только дописывается.
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include "ocv.h"
+
+constexpr char RAW_FILE_MAGIC[8] = { 'S','P','E','C','R','A','W','1' };
+constexpr uint32_t RAW_FRAME_MAGIC = 0x454d5246; // "FRME"
+constexpr uint32_t RAW_ALIGN = 64;
+
+/** Заголовок файла */
+struct RawFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint8_t reserved[48];
+};
+static_assert(sizeof(RawFileHeader) == RAW_ALIGN);
+
+/** Параметры видеозахвата, действовавшие при получении кадра */
+struct RawFrameProps {
+    double gain = 0;
+    double exposure = 0;
+    uint32_t fourcc = 0;
+};
+
+/** Заголовок записи кадра */
+struct RawFrameHeader {
+    uint32_t magic;
+    uint32_t header_size;
+    int64_t timestamp_us;   // время получения кадра, мкс от начала эпохи
+    int32_t rows;
+    int32_t cols;
+    int32_t type;           // тип cv::Mat (CV_8UC3 и т.п.)
+    uint32_t step;          // байт в строке
+    double gain;
+    double exposure;
+    uint32_t fourcc;
+    uint32_t reserved;
+    uint64_t data_size;     // размер данных кадра с выравниванием
+};
+static_assert(sizeof(RawFrameHeader) == RAW_ALIGN);
+
+
+/** Запись кадров в файл *.sraw
+ *  Если файл существует, новые кадры дописываются в его конец.
+ */
+class RawRecorder {
+public:
+    RawRecorder(const std::string& path);
+    void write(const cv::Mat& frame, const RawFrameProps& props);
+    uint64_t frames() const { return frames_written; }
+private:
+    std::ofstream file;
+    uint64_t frames_written = 0;
+};
+
+
+/** Файл, отображенный в память только для чтения
+ *  Страницы защищены от записи: попытка изменить данные (например, через cv::Mat поверх отображения)
+ *  завершается ошибкой доступа, а не молча изменяет копию страницы.
+ */
+class MappedFile {
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+private:
+    uint8_t* ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* map_handle = nullptr;
+#endif
+};
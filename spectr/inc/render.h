@@ -0,0 +1,54 @@
+/**
+ * @file render.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Цикл отрисовки видов с заданной частотой независимо от обработки кадров
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "model.h"
+
+class View;
+
+/** Цикл отрисовки с семантикой "последнее значение"
+ *
+ *  Подписывается на модели вместо видов. Уведомление модели (в потоке обработки) только увеличивает
+ *  счетчик обновлений модели. Поток интерфейса вызывает tick() с частотой отображения: виды моделей,
+ *  обновившихся с предыдущего такта, отрисовываются один раз по последним опубликованным данным,
+ *  промежуточные обновления пропускаются. Поэтому обработка идет с частотой камеры, а отрисовка
+ *  (imshow, построение графиков) - не чаще заданной частоты. Счетчики отрисованных и пропущенных
+ *  обновлений передаются виду перед отрисовкой (View::set_render_stat) для строки состояния.
+ */
+class RenderLoop : public ModelSubscriber {
+public:
+    struct Stat {
+        uint64_t updates = 0;   // уведомлений моделей
+        uint64_t rendered = 0;  // отрисовок активных видов
+        uint64_t skipped = 0;   // обновлений, замененных более новыми до отрисовки
+    };
+
+    RenderLoop(double fps);
+    void attach(Model& m, std::shared_ptr<View> view);
+    void on_data_updated(Model& m) override;
+    void tick();
+    int wait_ms() const;
+    Stat stat() const;
+
+private:
+    struct Entry {
+        Model* model;
+        std::shared_ptr<View> view;
+        std::atomic<uint64_t> published = 0; // обновлений модели (пишет поток обработки)
+        uint64_t seen = 0;                   // обновлений, учтенных отрисовкой (только поток интерфейса)
+        uint64_t rendered = 0, skipped = 0;  // счетчики вида (только поток интерфейса)
+    };
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point next_tick;
+    std::atomic<uint64_t> updates = 0;
+    uint64_t rendered = 0, skipped = 0;
+};
@@ -0,0 +1,34 @@
+/**
+ * @file sink.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Вывод опубликованных спектров в файл или поток (режим без окна)
+ */
+
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "model.h"
+
+/** Запись каждого опубликованного спектра модели строкой csv (разделитель ';')
+ *  Строка заголовка - "time_us;frames;" и шкала длин волн, повторяется при смене ширины спектра
+ *  или шкалы (калибровки).
+ *  Строка спектра - время публикации (мкс от начала эпохи), количество кадров и значения row_base
+ *  в масштабе одного кадра. Вызывается производителем (подписка на Model_Spectr).
+ */
+class SpectrCsvSink : public ModelSubscriber {
+public:
+    SpectrCsvSink(const std::string& path, std::ostream& std_out = std::cout);
+    void on_data_updated(Model& m) override;
+    uint64_t written() const { return count; }
+
+private:
+    std::ofstream file;
+    std::ostream* out;
+    std::string line;   // буфер строки (используется повторно)
+    std::vector<double> header_nm; // шкала последнего заголовка
+    uint64_t last_version = 0;
+    uint64_t count = 0;
+};
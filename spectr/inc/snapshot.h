@@ -0,0 +1,109 @@
+/**
+ * @file snapshot.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Публикация снимков данных одним писателем для нескольких читателей без блокировок
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/** Тройной буфер снимков данных
+ *
+ *  Писатель (один поток) заполняет свободный слот (begin_write) и делает его последним опубликованным
+ *  (end_write). Читатель получает последний опубликованный снимок (read) и закрепляет его счетчиком
+ *  на время использования: писатель никогда не пишет в последний опубликованный и закрепленные слоты,
+ *  поэтому читатель всегда видит целостный неизменяемый снимок, а писатель никогда не ждет читателей.
+ *  Если все слоты заняты (несколько читателей одновременно удерживают старые снимки),
+ *  begin_write возвращает nullptr и писатель пропускает публикацию.
+ */
+template <typename T>
+class SnapshotBuffer {
+public:
+    static const int SLOTS = 3;
+
+    /** Закрепленный снимок. Освобождается деструктором */
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+        Ref(Ref&& r) noexcept : buf(r.buf), slot(r.slot) { r.buf = nullptr; }
+        Ref& operator=(Ref&& r) noexcept {
+            if (this != &r) {
+                release();
+                buf = r.buf;
+                slot = r.slot;
+                r.buf = nullptr;
+            }
+            return *this;
+        }
+        ~Ref() { release(); }
+
+        explicit operator bool() const { return buf != nullptr; }
+        const T& operator*() const { return buf->slots[slot]; }
+        const T* operator->() const { return &buf->slots[slot]; }
+        void release() {
+            if (buf) {
+                buf->pins[slot].fetch_sub(1);
+                buf = nullptr;
+            }
+        }
+
+    private:
+        friend class SnapshotBuffer;
+        Ref(const SnapshotBuffer* b, int s) : buf(b), slot(s) {}
+        const SnapshotBuffer* buf = nullptr;
+        int slot = 0;
+    };
+
+    /** Писатель: свободный слот для заполнения или nullptr, если свободных слотов нет */
+    T* begin_write() {
+        const int l = latest.load();
+        for (int i = 0; i < SLOTS; i++) {
+            if (i != l && pins[i].load() == 0) {
+                writing = i;
+                return &slots[i];
+            }
+        }
+        skipped++;
+        return nullptr;
+    }
+
+    /** Писатель: публикация слота, полученного begin_write */
+    void end_write() {
+        latest.store(writing);
+        published.fetch_add(1);
+    }
+
+    /** Читатель: последний опубликованный снимок (пустая ссылка, если публикаций еще не было) */
+    Ref read() const {
+        while (true) {
+            const int i = latest.load();
+            if (i < 0) {
+                return Ref();
+            }
+            pins[i].fetch_add(1);
+            // Слот мог перестать быть последним и уйти писателю до закрепления - проверяем повторно
+            if (latest.load() == i) {
+                return Ref(this, i);
+            }
+            pins[i].fetch_sub(1);
+        }
+    }
+
+    /** Количество публикаций (номер последнего снимка) */
+    uint64_t version() const { return published.load(); }
+
+    /** Количество пропущенных публикаций из-за отсутствия свободного слота */
+    uint64_t skipped_count() const { return skipped; }
+
+private:
+    std::array<T, SLOTS> slots;
+    mutable std::array<std::atomic<int>, SLOTS> pins{};
+    std::atomic<int> latest{ -1 };
+    std::atomic<uint64_t> published{ 0 };
+    int writing = -1;
+    uint64_t skipped = 0;
+};
@@ -0,0 +1,140 @@
+/**
+ * @file store.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Долговременное хранилище опубликованных спектров (*.sspec) с разреженным индексом по времени
+ *
+ *  Файл состоит из заголовка StoreFileHeader и следующих за ним записей. Запись - заголовок StoreRecordHeader
+ *  и значения float, дополненные нулями до границы STORE_ALIGN байт. Записи двух видов: шкала длин волн
+ *  (калибровка, STORE_CALIB_MAGIC) и спектр (STORE_SPECTR_MAGIC). Спектр ссылается на действовавшую при его
+ *  записи шкалу смещением ее записи в файле. Файл только дописывается; заголовок файла хранит конец
+ *  последней полностью записанной записи (data_end), поэтому незавершенная запись читателю не видна.
+ *
+ *  Рядом с файлом ведется разреженный индекс <файл>.idx - пары (время, смещение) для каждого
+ *  index_step-го спектра. Поиск по времени - двоичный поиск по индексу и просмотр не более
+ *  index_step спектров. Время спектров не убывает (время записи ограничивается снизу предыдущим).
+ */
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "rawfile.h"
+
+constexpr char STORE_FILE_MAGIC[8] = { 'S','P','E','C','S','T','R','1' };
+constexpr uint32_t STORE_SPECTR_MAGIC = 0x43455053; // "SPEC"
+constexpr uint32_t STORE_CALIB_MAGIC = 0x424c4143;  // "CALB"
+constexpr uint32_t STORE_ALIGN = 8;
+
+/** Заголовок файла */
+struct StoreFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t data_end;      // конец последней полностью записанной записи
+    uint64_t spectra;       // количество записей спектров
+    uint32_t calibrations;  // количество записей шкалы
+    uint32_t index_step;    // спектров между записями индекса
+    int64_t last_time_us;   // время последнего спектра
+    uint8_t reserved[16];
+};
+static_assert(sizeof(StoreFileHeader) == 64);
+
+/** Заголовок записи */
+struct StoreRecordHeader {
+    uint32_t magic;
+    uint32_t width;         // количество значений
+    int64_t time_us;        // время записи, мкс от начала эпохи
+    uint64_t calib_offset;  // смещение записи шкалы длин волн (для записи шкалы - собственное смещение)
+    uint32_t calib_id;      // номер шкалы в файле (с 1)
+    float frames;           // количество кадров в накопленном спектре (значения хранятся в масштабе одного кадра)
+};
+static_assert(sizeof(StoreRecordHeader) == 32);
+
+/** Запись разреженного индекса */
+struct StoreIndexEntry {
+    int64_t time_us;
+    uint64_t offset;
+};
+
+
+/** Запись спектров в хранилище
+ *  Файл отображается в память для записи и растет порциями по chunk_bytes, поэтому запись спектра -
+ *  копирование значений в отображенную память без системных вызовов. При закрытии файл усекается до data_end.
+ *  Если файл существует, новые записи дописываются в его конец.
+ */
+class SpectrStore {
+public:
+    SpectrStore(const std::string& path, size_t chunk_bytes = 64 << 20, int index_step = 64);
+    ~SpectrStore();
+    SpectrStore(const SpectrStore&) = delete;
+    SpectrStore& operator=(const SpectrStore&) = delete;
+    void append(const double* nm, const double* y, int n, double frames, uint64_t calib_version);
+    const std::string& path() const { return file_path; }
+    uint64_t spectra() const { return header()->spectra; }
+
+private:
+    StoreFileHeader* header() const { return reinterpret_cast<StoreFileHeader*>(ptr); }
+    uint64_t write_record(uint32_t magic, const double* v, int n, double k, int64_t t, uint64_t calib_offset,
+                          uint32_t calib_id, float frames);
+    void map(size_t size);
+    void unmap();
+    void close();
+    static size_t round_up(size_t v, size_t step) { return (v + step - 1) / step * step; }
+
+    std::string file_path;
+    std::ofstream index;
+    size_t chunk = 0;
+    uint32_t index_step = 64;
+    uint8_t* ptr = nullptr;
+    size_t mapped = 0;
+    uint64_t calib_seen = UINT64_MAX; // версия калибровки модели, для которой записана текущая шкала
+    int calib_width = 0;
+    uint64_t calib_offset = 0;
+    uint32_t calib_id = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* map_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+
+/** Чтение хранилища спектров
+ *  Файл отображается в память только для чтения; видны записи, завершенные к моменту открытия.
+ *  Писатель может продолжать дописывать файл - для чтения новых записей читатель создается заново.
+ */
+class SpectrStoreReader {
+public:
+    /** Спектр из хранилища (указатели действительны на время жизни читателя) */
+    struct Record {
+        int64_t time_us;
+        uint32_t calib_id;
+        int width;
+        float frames;
+        const float* values;  // значения в масштабе одного кадра
+        const float* nm;      // шкала длин волн (пиксели, если калибровки не было) или nullptr, если шкала повреждена
+    };
+
+    SpectrStoreReader(const std::string& path);
+    uint64_t size() const { return spectra; }
+    int64_t first_time() const { return t_first; }
+    int64_t last_time() const { return t_last; }
+    uint64_t seek(int64_t time_us) const;
+    size_t for_each(int64_t from_us, int64_t to_us, const std::function<bool(const Record&)>& fn) const;
+    bool average(int64_t from_us, int64_t to_us, std::vector<double>& nm, std::vector<double>& mean) const;
+    size_t write_csv(const std::filesystem::path& path, int64_t from_us, int64_t to_us) const;
+
+private:
+    const StoreRecordHeader* record(uint64_t offset) const;
+    uint64_t next(uint64_t offset) const;
+
+    MappedFile file;
+    uint64_t data_begin = 0, data_end = 0;
+    std::vector<StoreIndexEntry> entries;  // разреженный индекс (из файла .idx и досчитанный просмотром хвоста)
+    uint64_t spectra = 0;
+    int64_t t_first = 0, t_last = 0;
+};
@@ -0,0 +1,60 @@
+/**
+ * @file tracks.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Несколько спектров (треков) на одном кадре, обрабатываемых за один проход
+ */
+
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "ocv.h"
+#include "model.h"
+#include "worker_pool.h"
+
+/** Набор треков - окон кадра со своими моделями спектра (калибровкой и накоплением)
+ *
+ *  Основной трек - модель, управляемая из интерфейса (окно, поворот, калибровка, режим накопления).
+ *  Дополнительные треки задаются в конфигурации (раздел tracks).
+ *  Суммы по столбцам всех окон без поворота считаются за один проход по кадру: кадр обходится полосами
+ *  по Projection::BAND_ROWS строк (параллельно на пуле потоков), в каждой полосе обрабатываются все окна,
+ *  которые ее пересекают. Поэтому время обработки зависит от суммарной площади окон, а не от числа треков.
+ *  Окна с поворотом (угол общий для всех треков) так же проецируются за один проход по кадру полосами
+ *  (Projection::project_many), каждое окно - своей проекцией.
+ *  Трек, окно которого не пересекается с кадром, пропускается (с сообщением в журнал при смене кадра),
+ *  а не считается по всему кадру.
+ */
+class TrackSet {
+public:
+    struct Track {
+        std::string name;
+        cv::Rect roi;
+        Model_Spectr* model;
+        bool outside = false;  // окно не пересекается с кадром: трек не обрабатывается и не публикуется
+    };
+
+    TrackSet(Model_Spectr& main, cv::FileStorage& fs, long accumulate_frames);
+    void set_pool(std::shared_ptr<WorkerPool> pool);
+    void udpate_data(const cv::Mat& frame);
+    std::vector<Model_Spectr*> models() const;
+    const std::vector<Track>& extra() const { return extra_tracks; }
+
+private:
+    static bool check_roi(const Model_Spectr& m, const std::string& name, cv::Size frame_size, bool& outside);
+
+    struct Straight {
+        Model_Spectr* model;
+        cv::Rect rect;
+        size_t offset;  // смещение сумм окна в sums
+    };
+
+    Model_Spectr& main;
+    std::vector<std::unique_ptr<Model_Spectr>> owned;
+    std::vector<Track> extra_tracks;
+    bool main_outside = false;          // окно основного трека не пересекается с кадром
+    std::shared_ptr<WorkerPool> pool;
+    std::vector<Straight> straight;     // окна без поворота текущего кадра
+    std::vector<uint32_t> sums;         // суммы по столбцам всех окон без поворота
+    std::vector<uint32_t> band_sums;    // частичные суммы по полосам
+    std::vector<Projection::Target> targets; // окна с поворотом текущего кадра
+};
@@ -5,9 +5,18 @@
  */
 
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include "ocv.h"
 #include "model.h"
+#include "tracks.h"
+#include "ratio.h"
+#include "decimation.h"
 #include "window.h"
 #include "fps.h"
 
@@ -17,43 +26,148 @@ class View : public ModelSubscriber {
 protected:
     Window& window;
     bool is_active = false;
+    FPS_Stat fps;                   // частота отрисовки вида
+    uint64_t rendered = 0, skipped = 0; // отрисованные и пропущенные (замененные более новыми) обновления модели
+    void append_render_stat(std::string& s, double processing_fps);
 public:
     View(Window& w) : window(w) {};
     virtual void activate() { is_active = true; };
     virtual void deactivate() { is_active = false; };
+    virtual void refresh() {};  // такт отрисовки без новых данных модели (поток интерфейса)
+    bool active() const { return is_active; }
+    void set_render_stat(uint64_t r, uint64_t s) { rendered = r; skipped = s; }
 };
 
 
-/** Отображение видеокадров */
+/** Отображение видеокадров
+ *
+ *  Кадр для показа (превью) готовит рабочий поток вида: снимок модели уменьшается до размера окна
+ *  (с сохранением пропорций, без увеличения), поверх накладывается сетка - маска, построенная один раз
+ *  для размера превью. Снимок модели только читается. on_data_updated передает рабочему потоку последний
+ *  снимок (необработанный предыдущий заменяется), а готовое превью выводится на следующем такте отрисовки
+ *  (refresh), поэтому ни поток интерфейса, ни поток обработки не заняты масштабированием кадров.
+ */
 class VideoView : public View {
 public:
-    VideoView(Window& w);
+    VideoView(Window& w, int width = 800, int height = 600);
+    ~VideoView();
     void showgrid(bool state);
     void on_data_updated(Model& m) override;
+    void refresh() override;
 private:
-    FPS_Stat fps;
-    bool add_grid;
+    void preview_loop();
+    void make_preview(const cv::Mat& frame);
+    const int width, height;   // наибольший размер превью
+    std::atomic<bool> add_grid = false;
+    std::string status; // строка состояния (буфер используется повторно)
+    // Обмен с рабочим потоком (под mtx)
+    std::mutex mtx;
+    std::condition_variable cv_pending;
+    Model_Video::SnapshotRef pending;  // снимок, ожидающий обработки
+    bool ready = false;                // в done готовое превью
+    bool stopping = false;
+    cv::Mat done;                      // готовое превью
+    cv::Size done_frame;               // размер исходного кадра готового превью
+    double done_fps = 0;               // частота обработки кадров из снимка готового превью
+    // Только рабочий поток
+    cv::Mat work;                      // строящееся превью
+    cv::Mat grid_mask;                 // маска сетки для размера превью (CV_8U)
+    // Только поток интерфейса
+    cv::Mat shown;                     // показанное превью
+    cv::Size shown_frame;
+    double shown_fps = 0;
+    std::thread worker;
 };
 
 
-/** Отображение спектров в виде графика */
+/** Отображение спектров в виде графика
+ *  График строится слоями: фон (рамка, оси, сетка, подписи) рисуется CvPlot и кэшируется до изменения
+ *  пределов шкал или подписи, а спектры, маркеры пиков и курсор выбора X рисуются поверх копии фона.
+ */
 class SpectrView : public View {
 public:
     SpectrView(Window& w, int width = 800, int height = 600);
     void activate() override;
     void pick_X(std::function<void(int x)> callback);
+    void show_noise(bool state);
+    void show_peaks(bool state);
+    void set_ratio(ratio_mode mode, const RatioOptions& opt);
+    void set_tracks(const std::vector<TrackSet::Track>& tracks);
     void on_data_updated(Model& m) override;
 private:
     void setup_mouse_handler();
     static void mouse_handler(int event, int x, int y, int flags, void* userdata);
-    std::pair<double, double> calc_limit(const cv::Mat &yData);
+    std::pair<double, double> calc_limit(const MinMaxPyramid& lod);
+    void update_background(const char* y_label);
+    cv::Point to_pixel(double x, double y) const;
+    int nearest_bin(double x) const;
+    void draw_series(const cv::Mat& x, const MinMaxPyramid& lod, const cv::Scalar& color);
     const int width, height; // размер вида
     const int Y_LIM_STEP = 50; // дисрктная величина для увеличения шкалы Y
     CvPlot::Axes axes;
     bool pick_X_mode = false;
     std::function<void(int x)> pick_X_callback;
-    FPS_Stat fps;
     int mouse_pos_x = -1;
     int mouse_pos_y = -1;
-    std::pair<double, double> mem_spectr_y_limits;
+    Model_Spectr::SnapshotRef shown; // отображаемый снимок данных модели
+    cv::Mat background;              // кэш фона: рамка, оси, сетка, подписи (перестраивается при смене шкал)
+    cv::Mat plot;                    // фон с графиками последнего обновления
+    cv::Mat canvas;                  // график с курсором выбора X
+    std::pair<double, double> bg_xlim, bg_ylim; // шкалы, для которых построен фон
+    const char* bg_label = "arb.u";
+    cv::Rect inner;                  // внутренняя область графика
+    double kx = 0, bx = 0, ky = 0, by = 0; // преобразование данных в пиксели внутренней области
+    std::vector<cv::Point> line_pts; // вершины ломаной (буфер используется повторно)
+    std::vector<std::pair<int, int>> columns; // точки ряда по столбцам графика (буфер используется повторно)
+    std::string status;              // строка состояния
+    bool noise_band = false;
+    bool peak_markers = false;
+    ratio_mode ratio = ratio_mode::off;
+    RatioOptions ratio_opt;
+    cv::Mat ratio_data;         // пропускание или оптическая плотность (считается только в этих режимах)
+    MinMaxPyramid lod_ratio;    // пирамида ratio_data (пирамиды спектров строятся моделью в снимке)
+    struct ShownTrack {
+        Model_Spectr* model;
+        Model_Spectr::SnapshotRef shown;  // отображаемый снимок трека
+    };
+    std::vector<ShownTrack> tracks;     // дополнительные треки
+};
+
+
+/** Отображение истории спектров в виде водопада
+ *
+ *  Каждый спектр истории модели (SpectrHistory) переводится палитрой в одну строку изображения,
+ *  самый новый спектр - вверху. Столбцы вида равномерны по шкале спектра (по длине волны после калибровки).
+ *  Растеризованные строки хранятся в кольце изображения: при обновлении
+ *  растеризуются только новые спектры, а вывод собирается из двух непрерывных частей кольца.
+ *  Диапазон палитры следует за данными (расширяется сразу, сужается медленно) и применяется
+ *  только к новым строкам - уже нарисованные строки не перерисовываются.
+ */
+class WaterfallView : public View {
+public:
+    WaterfallView(Window& w, int width = 800, int height = 600);
+    void activate() override;
+    void on_data_updated(Model& m) override;
+private:
+    void clear();
+    void set_scale(const double* x, int n);
+    void draw_row(const std::vector<float>& y);
+    const int width, height;     // размер вида (ширина - точек спектра, высота - строк истории)
+    const float RANGE_DECAY = 0.02F; // доля сужения диапазона палитры на строку
+    cv::Vec3b palette[256];
+    cv::Mat ring;                // CV_8UC3 height x width, растеризованные строки
+    std::vector<double> ring_time; // время записи строк кольца, с
+    int head = 0;                // строка кольца с самым новым спектром
+    int filled = 0;              // заполнено строк кольца
+    cv::Mat canvas;              // выводимое изображение (собирается из кольца)
+    std::vector<float> row, scaled; // строка истории и она же в ширину вида (буферы используются повторно)
+    std::vector<double> index_x; // шкала из номеров точек (для строк, ширина которых не совпадает с текущей)
+    std::vector<double> scale_x; // шкала строк (длины волн или номера точек), для которой построены columns
+    std::vector<std::pair<int, int>> columns; // точки строки по столбцам вида
+    std::vector<float> column_f; // пустой столбец (растяжение): вес точки columns[x].first при интерполяции от предыдущей
+    uint64_t next_index = 0;     // номер следующей строки истории для растеризации
+    uint64_t generation = 0;     // номер сброса истории, к которому относится кольцо
+    float lo = 0, hi = 0;        // диапазон палитры
+    bool range_set = false;
+    std::string status;
 };
@@ -0,0 +1,51 @@
+/**
+ * @file worker_pool.h
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Пул постоянных рабочих потоков для параллельной обработки кадра
+ */
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+
+/** Пул постоянных рабочих потоков
+ *  Потоки создаются один раз. run(n, fn) выполняет fn(i) для всех i из [0, n)
+ *  на потоках пула и на вызывающем потоке и возвращает управление после завершения всех задач.
+ *  Порядок выполнения задач не определен - результаты задач должны объединяться вызывающей стороной.
+ */
+class WorkerPool {
+public:
+    WorkerPool(int threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /** Общее количество потоков, включая вызывающий */
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    template <typename F>
+    void run(int tasks, F&& fn) {
+        run_tasks(tasks, [](void* ctx, int i) { (*static_cast<std::remove_reference_t<F>*>(ctx))(i); }, &fn);
+    }
+
+private:
+    typedef void (*task_fn)(void* ctx, int i);
+    void run_tasks(int tasks, task_fn fn, void* ctx);
+    void execute();
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable start_cv, done_cv;
+    uint64_t generation = 0;  // номер текущего задания
+    int busy = 0;             // количество потоков пула, еще не закончивших задание
+    bool stopping = false;
+    task_fn job_fn = nullptr;
+    void* job_ctx = nullptr;
+    int job_tasks = 0;
+    std::atomic<int> next_task = 0;
+};
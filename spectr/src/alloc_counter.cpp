@@ -0,0 +1,76 @@
+/**
+ * @file alloc_counter.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Подсчет выделений памяти в отладочной сборке заменой глобальных operator new/delete
+ */
+
+#include <cstdlib>
+#include <new>
+#include "alloc_counter.h"
+
+#ifndef NDEBUG
+
+static thread_local uint64_t allocations = 0;
+
+uint64_t thread_heap_allocations() {
+    return allocations;
+}
+
+static void* counted_alloc(std::size_t size) {
+    allocations++;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = counted_alloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    if (void* p = counted_alloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+#else
+
+uint64_t thread_heap_allocations() {
+    return 0;
+}
+
+#endif
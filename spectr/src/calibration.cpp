@@ -0,0 +1,131 @@
+/**
+ * @file calibration.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация калибровки шкалы длин волн и передискретизации спектра
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "calibration.h"
+#include "ocv.h"
+#include "optlog.h"
+
+/*---------------- WavelengthCalibration --------------------------------*/
+
+/** Подбор полинома по точкам калибровки
+ * @param pts точки (позиция пикселя, длина волны в нм) с различными позициями
+ * @param order желаемая степень полинома (не больше количества точек минус один)
+ * @return false, если точек меньше двух (калибровка сбрасывается)
+ */
+bool WavelengthCalibration::fit(const std::vector<std::pair<int, int>>& pts, int order) {
+    coef.clear();
+    residual = 0;
+    const int n = static_cast<int>(pts.size());
+    order = std::min(std::max(order, 1), n - 1);
+    if (n < 2) {
+        return false;
+    }
+
+    const auto [lo, hi] = std::minmax_element(pts.begin(), pts.end());
+    x0 = 0.5 * (lo->first + hi->first);
+    xs = std::max(0.5 * (hi->first - lo->first), 1.0);
+
+    // Система Вандермонда A * c = y решается по МНК через SVD
+    cv::Mat A(n, order + 1, CV_64F), y(n, 1, CV_64F), c;
+    for (int i = 0; i < n; i++) {
+        const double t = (pts[i].first - x0) / xs;
+        double p = 1.0;
+        for (int k = 0; k <= order; k++, p *= t) {
+            A.at<double>(i, k) = p;
+        }
+        y.at<double>(i) = pts[i].second;
+    }
+    cv::solve(A, y, c, cv::DECOMP_SVD);
+    coef.assign(c.begin<double>(), c.end<double>());
+
+    for (const auto& p : pts) {
+        const double d = (*this)(p.first) - p.second;
+        residual += d * d;
+    }
+    residual = std::sqrt(residual / n);
+    log1 << "Calibration: " << n << " points, order " << order << ", rms " << residual << " nm" << std::endl;
+    return true;
+}
+
+/** Длина волны для позиции пикселя x (схема Горнера) */
+double WavelengthCalibration::operator()(double x) const {
+    const double t = (x - x0) / xs;
+    double v = 0;
+    for (auto k = coef.rbegin(); k != coef.rend(); ++k) {
+        v = v * t + *k;
+    }
+    return v;
+}
+
+
+/*---------------- UniformResampler --------------------------------*/
+
+/** Задание сетки длин волн from, from + step, ... не дальше to (step <= 0 - сетка не используется) */
+void UniformResampler::set_grid(double f, double to, double s) {
+    from = f;
+    step = s;
+    count = step > 0 && to >= from ? static_cast<int>(std::floor((to - from) / step + 1e-9)) + 1 : 0;
+    valid = false;
+}
+
+/** Построение весов для шкалы nm из n ячеек
+ *  Шкала должна быть монотонной (возрастающей или убывающей), иначе передискретизация отключается.
+ */
+void UniformResampler::build(const double* nm, int n) {
+    valid = false;
+    if (count == 0 || n < 2) {
+        return;
+    }
+    const bool increasing = nm[n - 1] > nm[0];
+    for (int i = 1; i < n; i++) {
+        if (increasing ? nm[i] <= nm[i - 1] : nm[i] >= nm[i - 1]) {
+            log0 << "Wavelength scale is not monotonic, uniform resampling is off" << std::endl;
+            return;
+        }
+    }
+    index.assign(count, -1);
+    weight.assign(count, 0.0);
+    cover_from = cover_to = 0;
+    int i = 0;
+    for (int k = 0; k < count; k++) {
+        // Узлы сетки возрастают, поэтому поиск интервала продолжается с предыдущей позиции
+        const double g = grid(k);
+        if (increasing) {
+            while (i < n - 1 && nm[i + 1] < g) {
+                i++;
+            }
+        }
+        else {
+            i = k == 0 ? n - 2 : i;
+            while (i > 0 && nm[i] < g) {
+                i--;
+            }
+        }
+        if (i >= n - 1) {
+            break;
+        }
+        const double a = nm[i], b = nm[i + 1];
+        if ((g - a) * (g - b) <= 0) {
+            index[k] = i;
+            weight[k] = (g - a) / (b - a);
+            if (cover_to == 0) {
+                cover_from = k;
+            }
+            cover_to = k + 1;
+        }
+    }
+    valid = true;
+}
+
+/** Передискретизация спектра in (n ячеек шкалы build) в out (size() узлов) */
+void UniformResampler::apply(const double* in, double* out) const {
+    for (int k = 0; k < count; k++) {
+        const int i = index[k];
+        out[k] = i < 0 ? 0.0 : in[i] + weight[k] * (in[i + 1] - in[i]);
+    }
+}
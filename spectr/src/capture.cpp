@@ -4,7 +4,12 @@
  * @brief Реализация классов видеозахвата
  */
 
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include "capture.h"
+#include "helpers.h"
 #include "optlog.h"
 
 using namespace std::string_literals;
@@ -70,7 +75,14 @@ std::unique_ptr<Capture> Capture::create(cv::FileStorage& fs) {
          return std::make_unique<CameraCapture>(src, fs);
     }
     else if (src.isString()) {
-        return std::make_unique<FileCapture>(src, fs);
+        std::string path = src;
+        if (path == "synthetic") {
+            return std::make_unique<SyntheticCapture>(fs);
+        }
+        if (path.ends_with(".sraw")) {
+            return std::make_unique<RawFileCapture>(path, fs);
+        }
+        return std::make_unique<FileCapture>(path, fs);
     }
     else {
         throw std::runtime_error("No valid source in config file");
@@ -90,6 +102,8 @@ void Capture::set_property(std::string prop, double value) {
         log0 << "Unknown property '" << prop << "'" << std::endl;
         return;
     }
+    std::lock_guard<std::mutex> lock(cap_mtx);
+    props_changed++;
     if (!cap.set(it->second, value)) {
         log0 << "Property '" << prop << "' not supported by backend" << std::endl;
     }
@@ -104,11 +118,13 @@ void Capture::set_property(std::string prop, double value) {
 
 /** Возвращает высоту захватываемого кадра */
 int Capture::height() {
+    std::lock_guard<std::mutex> lock(cap_mtx);
     return static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
 }
 
 /** Возвращает ширину захватываемого кадра */
 int Capture::width() {
+    std::lock_guard<std::mutex> lock(cap_mtx);
     return static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
 }
 
@@ -119,6 +135,7 @@ double Capture::get_property(std::string prop)
         log0 << "Unknown property '" << prop << "'" << std::endl;
         return 0.0;
     }
+    std::lock_guard<std::mutex> lock(cap_mtx);
     return cap.get(it->second);
 }
 
@@ -144,12 +161,47 @@ CameraCapture::CameraCapture(int devNo, cv::FileStorage& fs) {
 
 /** Ожидает и возвращает очередной кадр  */
 void CameraCapture::read(cv::Mat& frame) {
+    std::lock_guard<std::mutex> lock(cap_mtx);
     cap.read(frame);
 }
 
 
 /*-------------------- File Capture ------------------------------------ */
 
+/** Формирует список файлов серии изображений
+ * @param path путь к первому файлу серии (img_00.jpg) или шаблон имени (img_%02d.jpg)
+ * @return имена существующих файлов серии по порядку, начиная с первого
+ */
+static std::vector<std::string> sequence_files(const std::string& path) {
+    std::string pattern = path;
+    int first = 0;
+    if (path.find('%') == std::string::npos) {
+        auto name_pos = path.find_last_of("/\\");
+        name_pos = (name_pos == std::string::npos) ? 0 : name_pos + 1;
+        auto dig_end = path.find_last_of("0123456789");
+        if (dig_end == std::string::npos || dig_end < name_pos) {
+            return { path };
+        }
+        auto dig_begin = path.find_last_not_of("0123456789", dig_end) + 1;
+        auto width = dig_end - dig_begin + 1;
+        first = std::stoi(path.substr(dig_begin, width));
+        pattern = path.substr(0, dig_begin) + "%0" + std::to_string(width) + "d" + path.substr(dig_end + 1);
+    }
+    else if (!std::filesystem::exists(cv::format(pattern.c_str(), first))) {
+        first = 1;
+    }
+
+    std::vector<std::string> files;
+    for (int i = first; ; i++) {
+        auto name = cv::format(pattern.c_str(), i);
+        if (!std::filesystem::exists(name)) {
+            break;
+        }
+        files.push_back(name);
+    }
+    return files;
+}
+
 /** Создание объекта захвата с файлов изображений. 
  * @param path путь к первому файлу в серии изображений, имя файла img_%02d.jpg
  * @param fs Открытый FileStorage с конфигурацией.
@@ -169,21 +221,264 @@ FileCapture::FileCapture(std::string path, cv::FileStorage& fs)
             delay_ms = 1000 / static_cast<int>(v);
         }
     }
+    unthrottled = load_or_default(fs, "file-capture", "UNTHROTTLED", 0) != 0;
+    if (load_or_default(fs, "file-capture", "PRELOAD", 0) != 0) {
+        preload(sequence_files(path));
+        log1 << "Preloaded " << frames.size() << " frames from " << path << std::endl;
+    }
+}
+
+/** Загружает и декодирует всю серию изображений в память
+ *  Декодирование выполняется параллельно на всех ядрах, кадры размещаются подряд в одном буфере store.
+ * @throw runtime_error если файл не читается или размер кадра отличается от первого
+ */
+void FileCapture::preload(const std::vector<std::string>& files) {
+    if (files.empty()) {
+        throw std::runtime_error("Empty image sequence");
+    }
+    cv::Mat first = cv::imread(files.front(), cv::IMREAD_COLOR);
+    if (first.empty()) {
+        throw std::runtime_error("Can't decode image "s + files.front());
+    }
+    const int n = static_cast<int>(files.size());
+    store.create(first.rows * n, first.cols, first.type());
+    frames.resize(n);
+    for (int i = 0; i < n; i++) {
+        frames[i] = store.rowRange(i * first.rows, (i + 1) * first.rows);
+    }
+    first.copyTo(frames[0]);
+
+    std::atomic<int> bad_file = -1;
+    cv::parallel_for_(cv::Range(1, n), [&](const cv::Range& r) {
+        for (int i = r.start; i < r.end; i++) {
+            cv::Mat img = cv::imread(files[i], cv::IMREAD_COLOR);
+            if (img.size() != first.size() || img.type() != first.type()) {
+                bad_file = i;
+                continue;
+            }
+            img.copyTo(frames[i]);
+        }
+    });
+    if (bad_file >= 0) {
+        throw std::runtime_error("Can't decode image or image size differs: "s + files[bad_file]);
+    }
 }
 
 /** Ожидает и возвращает очередной кадр  */
 void FileCapture::read(cv::Mat& frame) {
-    if (grab_time != 0) {
+    if (!unthrottled && grab_time != 0) {
         int64_t from_last_grab_ms = std::abs(cv::getTickCount() - grab_time) / ticks_in_ms;
         while (from_last_grab_ms < delay_ms) {
             std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms - from_last_grab_ms));
-            from_last_grab_ms = std::abs(cv::getTickCount() - grab_time) * ticks_in_ms;
+            from_last_grab_ms = std::abs(cv::getTickCount() - grab_time) / ticks_in_ms;
         }
     }
-    cap.read(frame);
-    if (frame.empty()) {
-        cap.set(cv::CAP_PROP_POS_FRAMES, cap.get(cv::CAP_PROP_IMAGES_BASE));
+    if (!frames.empty()) {
+        frames[pos].copyTo(frame);
+        pos = (pos + 1) % frames.size();
+    }
+    else {
+        std::lock_guard<std::mutex> lock(cap_mtx);
         cap.read(frame);
+        if (frame.empty()) {
+            cap.set(cv::CAP_PROP_POS_FRAMES, cap.get(cv::CAP_PROP_IMAGES_BASE));
+            cap.read(frame);
+        }
     }
     grab_time = cv::getTickCount();
 }
+
+
+/*-------------------- Raw File Capture ------------------------------------ */
+
+/** Открытие записи кадров *.sraw
+ * @param path путь к файлу записи
+ * @param fs Открытый FileStorage с конфигурацией (параметр raw-replay:REALTIME)
+ * @throw runtime_error если файл не является записью кадров или не содержит ни одного кадра
+ */
+RawFileCapture::RawFileCapture(std::string path, cv::FileStorage& fs) : file(path) {
+    realtime = load_or_default(fs, "raw-replay", "REALTIME", 1) != 0;
+
+    auto fh = reinterpret_cast<const RawFileHeader*>(file.data());
+    if (file.size() < sizeof(RawFileHeader) || std::memcmp(fh->magic, RAW_FILE_MAGIC, sizeof(fh->magic)) != 0) {
+        throw std::runtime_error("Not a raw frames file "s + path);
+    }
+    size_t offset = fh->header_size;
+    while (offset + sizeof(RawFrameHeader) <= file.size()) {
+        auto h = reinterpret_cast<const RawFrameHeader*>(file.data() + offset);
+        if (h->magic != RAW_FRAME_MAGIC || offset + h->header_size + h->data_size > file.size() ||
+            static_cast<uint64_t>(h->step) * h->rows > h->data_size) {
+            log0 << "Raw file " << path << " is truncated or damaged after frame " << index.size() << std::endl;
+            break;
+        }
+        index.push_back(h);
+        offset += h->header_size + h->data_size;
+    }
+    if (index.empty()) {
+        throw std::runtime_error("No frames in raw file "s + path);
+    }
+    current = index.front();
+    log1 << "Raw file " << path << ": " << index.size() << " frames" << std::endl;
+}
+
+/** Параметры записи не меняются при воспроизведении */
+void RawFileCapture::set_property(std::string prop, [[maybe_unused]] double value) {
+    log0 << "Property '" << prop << "' can't be changed for recorded stream" << std::endl;
+}
+
+/** Возвращает записанные параметры GAIN, EXPOSURE, FOURCC текущего кадра и размер кадра */
+double RawFileCapture::get_property(std::string prop) {
+    std::lock_guard<std::mutex> lock(cap_mtx);
+    if (prop == "GAIN") {
+        return current->gain;
+    }
+    else if (prop == "EXPOSURE") {
+        return current->exposure;
+    }
+    else if (prop == "FOURCC") {
+        return current->fourcc;
+    }
+    else if (prop == "FRAME_WIDTH") {
+        return current->cols;
+    }
+    else if (prop == "FRAME_HEIGHT") {
+        return current->rows;
+    }
+    log0 << "Property '" << prop << "' isn't recorded" << std::endl;
+    return 0.0;
+}
+
+int RawFileCapture::height() {
+    return index.front()->rows;
+}
+
+int RawFileCapture::width() {
+    return index.front()->cols;
+}
+
+/** Возвращает очередной кадр записи без копирования данных */
+void RawFileCapture::read(cv::Mat& frame) {
+    using namespace std::chrono;
+    const RawFrameHeader* h = index[pos];
+    if (realtime) {
+        int64_t now_us = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+        if (pos == 0) {
+            due_us = now_us;
+        }
+        else {
+            int64_t dt = h->timestamp_us - index[pos - 1]->timestamp_us;
+            if (dt < 0 || dt > 1000000) { 
+                dt = 0; // граница между сеансами записи
+            }
+            due_us += dt;
+        }
+        if (due_us > now_us) {
+            std::this_thread::sleep_for(microseconds(due_us - now_us));
+        }
+    }
+    frame = cv::Mat(h->rows, h->cols, h->type, const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(h) + h->header_size), h->step);
+    {
+        std::lock_guard<std::mutex> lock(cap_mtx);
+        current = h;
+    }
+    pos = (pos + 1) % index.size();
+}
+
+
+/*-------------------- Synthetic Capture ------------------------------------ */
+
+/** Создание синтетического источника кадров
+ * @param fs Открытый FileStorage с конфигурацией, раздел synthetic:
+ *   WIDTH, HEIGHT - размер кадра; DEPTH - 8 или 16 бит на канал; FPS - частота кадров (0 - без ограничения);
+ *   LINES - позиции линий в пикселях; LINE_WIDTH - сигма гауссова профиля линии, пикс;
+ *   AMPLITUDE, NOISE - амплитуда линий и сигма шума в единицах 8-битной шкалы;
+ *   TILT - наклон линий, градусы; BANK - количество кадров в банке; SEED - затравка генератора шума;
+ *   ZERO_COPY - 1: выдавать кадры банка без копирования (кадры нельзя изменять, сетку видео не включать).
+ */
+SyntheticCapture::SyntheticCapture(cv::FileStorage& fs) {
+    const int w = load_or_default(fs, "synthetic", "WIDTH", 800);
+    const int h = load_or_default(fs, "synthetic", "HEIGHT", 600);
+    const int depth = load_or_default(fs, "synthetic", "DEPTH", 8) == 16 ? CV_16U : CV_8U;
+    const int fps = load_or_default(fs, "synthetic", "FPS", 20);
+    const double line_width = load_or_default(fs, "synthetic", "LINE_WIDTH", 3.0);
+    const double amplitude = load_or_default(fs, "synthetic", "AMPLITUDE", 200.0);
+    const double noise = load_or_default(fs, "synthetic", "NOISE", 2.0);
+    const double tilt = load_or_default(fs, "synthetic", "TILT", 0.0);
+    const int bank_size = std::max(1, load_or_default(fs, "synthetic", "BANK", 4));
+    const int seed = load_or_default(fs, "synthetic", "SEED", 1);
+    zero_copy = load_or_default(fs, "synthetic", "ZERO_COPY", 0) != 0;
+    period_us = fps > 0 ? 1000000 / fps : 0;
+    if (w <= 0 || h <= 0 || line_width <= 0) {
+        throw std::runtime_error("Bad synthetic source size or line width");
+    }
+
+    auto lines_node = fs["synthetic"]["LINES"];
+    if (lines_node.isSeq()) {
+        for (auto n : lines_node) {
+            line_x.push_back(static_cast<double>(n));
+        }
+    }
+    else {
+        line_x = { w * 0.25, w * 0.5, w * 0.75 };
+    }
+
+    // Изображение линий без шума
+    const double scale = depth == CV_16U ? 257.0 : 1.0;
+    const double slope = std::tan(tilt * CV_PI / 180.0);
+    const int half_span = static_cast<int>(std::ceil(4 * line_width));
+    cv::Mat base = cv::Mat::zeros(h, w, CV_32F);
+    for (int y = 0; y < h; y++) {
+        float* row = base.ptr<float>(y);
+        for (double x0 : line_x) {
+            const double xc = x0 + (y - h / 2.0) * slope;
+            const int x_from = std::max(0, static_cast<int>(xc) - half_span);
+            const int x_to = std::min(w - 1, static_cast<int>(xc) + half_span);
+            for (int x = x_from; x <= x_to; x++) {
+                const double d = (x - xc) / line_width;
+                row[x] += static_cast<float>(amplitude * scale * std::exp(-0.5 * d * d));
+            }
+        }
+    }
+
+    cv::RNG rng(static_cast<uint64_t>(seed));
+    cv::Mat noisy(h, w, CV_32F), gray;
+    bank.resize(bank_size);
+    for (auto& frame : bank) {
+        rng.fill(noisy, cv::RNG::NORMAL, 0.0, noise * scale);
+        noisy += base;
+        noisy.convertTo(gray, depth);
+        cv::cvtColor(gray, frame, cv::COLOR_GRAY2BGR);
+    }
+    log1 << "Synthetic source " << w << "x" << h << ", lines at x=";
+    for (double x : line_x) {
+        log1 << x << " ";
+    }
+    log1 << std::endl;
+}
+
+int SyntheticCapture::height() {
+    return bank.front().rows;
+}
+
+int SyntheticCapture::width() {
+    return bank.front().cols;
+}
+
+/** Возвращает очередной кадр банка с заданной частотой кадров */
+void SyntheticCapture::read(cv::Mat& frame) {
+    using namespace std::chrono;
+    if (period_us > 0) {
+        int64_t now_us = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+        due_us = std::max(due_us + period_us, now_us - period_us);
+        if (due_us > now_us) {
+            std::this_thread::sleep_for(microseconds(due_us - now_us));
+        }
+    }
+    if (zero_copy) {
+        frame = bank[pos];
+    }
+    else {
+        bank[pos].copyTo(frame);
+    }
+    pos = (pos + 1) % bank.size();
+}
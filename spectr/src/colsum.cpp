@@ -0,0 +1,241 @@
+/**
+ * @file colsum.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация суммирования изображения по столбцам с выбором SIMD-реализации во время выполнения
+ */
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "colsum.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+    #define COLSUM_X86 1
+    #include <immintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        #define TARGET_AVX2 __attribute__((target("avx2")))
+    #else
+        #define TARGET_AVX2
+    #endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define COLSUM_NEON 1
+    #include <arm_neon.h>
+#endif
+
+// Количество 8-битных строк, которое можно сложить в 16-битном аккумуляторе без переполнения
+static const int U16_ACC_ROWS = 256;
+
+// Ядра добавляют к аккумуляторам одну строку изображения из n элементов
+typedef void (*add_row_u8_fn)(const uint8_t* src, uint16_t* acc, int n);
+typedef void (*add_row_u16_fn)(const uint16_t* src, uint32_t* acc, int n);
+
+struct ColumnSumKernels {
+    const char* name;
+    add_row_u8_fn add_row_u8;
+    add_row_u16_fn add_row_u16;
+};
+
+
+/*---------------------- Scalar --------------------------------*/
+
+static void add_row_u8_scalar(const uint8_t* src, uint16_t* acc, int n) {
+    for (int i = 0; i < n; i++) {
+        acc[i] = static_cast<uint16_t>(acc[i] + src[i]);
+    }
+}
+
+static void add_row_u16_scalar(const uint16_t* src, uint32_t* acc, int n) {
+    for (int i = 0; i < n; i++) {
+        acc[i] += src[i];
+    }
+}
+
+
+/*---------------------- x86: SSE2, AVX2 --------------------------------*/
+#ifdef COLSUM_X86
+
+static void add_row_u8_sse2(const uint8_t* src, uint16_t* acc, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i <= n - 16; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i + 8));
+        a0 = _mm_add_epi16(a0, _mm_unpacklo_epi8(v, zero));
+        a1 = _mm_add_epi16(a1, _mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i + 8), a1);
+    }
+    add_row_u8_scalar(src + i, acc + i, n - i);
+}
+
+static void add_row_u16_sse2(const uint16_t* src, uint32_t* acc, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i <= n - 8; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i + 4));
+        a0 = _mm_add_epi32(a0, _mm_unpacklo_epi16(v, zero));
+        a1 = _mm_add_epi32(a1, _mm_unpackhi_epi16(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i + 4), a1);
+    }
+    add_row_u16_scalar(src + i, acc + i, n - i);
+}
+
+static TARGET_AVX2 void add_row_u8_avx2(const uint8_t* src, uint16_t* acc, int n) {
+    int i = 0;
+    for (; i <= n - 32; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i + 16));
+        a0 = _mm256_add_epi16(a0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        a1 = _mm256_add_epi16(a1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), a0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i + 16), a1);
+    }
+    add_row_u8_scalar(src + i, acc + i, n - i);
+}
+
+static TARGET_AVX2 void add_row_u16_avx2(const uint16_t* src, uint32_t* acc, int n) {
+    int i = 0;
+    for (; i <= n - 16; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i + 8));
+        a0 = _mm256_add_epi32(a0, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)));
+        a1 = _mm256_add_epi32(a1, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), a0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i + 8), a1);
+    }
+    add_row_u16_scalar(src + i, acc + i, n - i);
+}
+
+#endif
+
+
+/*---------------------- ARM: NEON --------------------------------*/
+#ifdef COLSUM_NEON
+
+static void add_row_u8_neon(const uint8_t* src, uint16_t* acc, int n) {
+    int i = 0;
+    for (; i <= n - 16; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(v)));
+        vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(v)));
+    }
+    add_row_u8_scalar(src + i, acc + i, n - i);
+}
+
+static void add_row_u16_neon(const uint16_t* src, uint32_t* acc, int n) {
+    int i = 0;
+    for (; i <= n - 8; i += 8) {
+        uint16x8_t v = vld1q_u16(src + i);
+        vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(v)));
+        vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4), vget_high_u16(v)));
+    }
+    add_row_u16_scalar(src + i, acc + i, n - i);
+}
+
+#endif
+
+
+/*---------------------- Dispatch --------------------------------*/
+
+static const ColumnSumKernels scalar_kernels = { "scalar", add_row_u8_scalar, add_row_u16_scalar };
+
+/** Выбор реализации по возможностям процессора */
+static ColumnSumKernels select_kernels() {
+#if defined(COLSUM_X86)
+    if (cv::checkHardwareSupport(CV_CPU_AVX2)) {
+        return { "avx2", add_row_u8_avx2, add_row_u16_avx2 };
+    }
+    if (cv::checkHardwareSupport(CV_CPU_SSE2)) {
+        return { "sse2", add_row_u8_sse2, add_row_u16_sse2 };
+    }
+    return scalar_kernels;
+#elif defined(COLSUM_NEON)
+    return { "neon", add_row_u8_neon, add_row_u16_neon };
+#else
+    return scalar_kernels;
+#endif
+}
+
+static const ColumnSumKernels& kernels() {
+    static const ColumnSumKernels k = select_kernels();
+    return k;
+}
+
+/** Суммирование по столбцам заданными ядрами */
+static void column_sum_with(const ColumnSumKernels& k, const cv::Mat& img, uint32_t* sums) {
+    CV_Assert(img.depth() == CV_8U || img.depth() == CV_16U);
+    const int n = img.cols * img.channels();
+    if (img.depth() == CV_8U) {
+        // 8-битные строки складываются в 16-битные аккумуляторы блоками по U16_ACC_ROWS строк,
+        // после каждого блока аккумуляторы переносятся в 32-битные суммы
+        thread_local std::vector<uint16_t> acc;
+        acc.resize(n);
+        for (int r0 = 0; r0 < img.rows; r0 += U16_ACC_ROWS) {
+            const int r1 = std::min(img.rows, r0 + U16_ACC_ROWS);
+            std::fill(acc.begin(), acc.end(), uint16_t(0));
+            for (int r = r0; r < r1; r++) {
+                k.add_row_u8(img.ptr<uint8_t>(r), acc.data(), n);
+            }
+            for (int i = 0; i < n; i++) {
+                sums[i] += acc[i];
+            }
+        }
+    }
+    else {
+        for (int r = 0; r < img.rows; r++) {
+            k.add_row_u16(img.ptr<uint16_t>(r), sums, n);
+        }
+    }
+}
+
+void column_sum(const cv::Mat& img, uint32_t* sums) {
+    column_sum_with(kernels(), img, sums);
+}
+
+const char* column_sum_isa() {
+    return kernels().name;
+}
+
+void column_sum_ref(const cv::Mat& img, uint32_t* sums) {
+    CV_Assert(img.depth() == CV_8U || img.depth() == CV_16U);
+    const int n = img.cols * img.channels();
+    for (int r = 0; r < img.rows; r++) {
+        for (int i = 0; i < n; i++) {
+            sums[i] += img.depth() == CV_8U ? img.ptr<uint8_t>(r)[i] : img.ptr<uint16_t>(r)[i];
+        }
+    }
+}
+
+bool column_sum_selftest() {
+    std::mt19937 gen(12345);
+    const int sizes[][2] = { {1, 1}, {3, 17}, {255, 33}, {256, 64}, {257, 100}, {600, 801}, {1000, 95} };
+    for (auto type : { CV_8UC1, CV_8UC3, CV_16UC1, CV_16UC3 }) {
+        for (auto& sz : sizes) {
+            cv::Mat img(sz[0], sz[1], type);
+            const int n = img.cols * img.channels();
+            for (int r = 0; r < img.rows; r++) {
+                for (int i = 0; i < n; i++) {
+                    if (img.depth() == CV_8U) {
+                        img.ptr<uint8_t>(r)[i] = static_cast<uint8_t>(gen());
+                    }
+                    else {
+                        img.ptr<uint16_t>(r)[i] = static_cast<uint16_t>(gen());
+                    }
+                }
+            }
+            std::vector<uint32_t> fast(n, 7), ref(n, 7);
+            column_sum(img, fast.data());
+            column_sum_ref(img, ref.data());
+            if (fast != ref) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -3,32 +3,75 @@
  * @author Sergey Simonov (sb.simonov@gmail.com)
  */
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <filesystem>
 #include <fstream>
 #include "controller.h"
+#include "grabber.h"
+#include "tracks.h"
 #include "helpers.h"
 #include "window.h"
 #include "view.h"
+#include "render.h"
+#include "sink.h"
 #include "optlog.h"
 #include "save_dialog.h"
 #include "format.h"
+#include "alloc_counter.h"
 
 /** Контсруктор объекта
  *  @param config_file путь к файлу с глобальными настройками программы
+ *  @param headless режим без окна (run_headless): окно и виды не создаются, локальные настройки не сохраняются
  */
-Controller::Controller(const std::string& config_file) : config_file(config_file) {
+Controller::Controller(const std::string& config_file, bool headless) : headless(headless), config_file(config_file) {
     cv::FileStorage fs;
     if (!fs.open(config_file, cv::FileStorage::READ | cv::FileStorage::FORMAT_YAML)) {
         throw std::runtime_error(std::string("Can't open config file ") + config_file);
     }
-    glob_opt.calib_v[0] = load_or_default(fs, "spectr", "CALIB_L1", glob_opt.calib_v[0]);
-    glob_opt.calib_v[1] = load_or_default(fs, "spectr", "CALIB_L2", glob_opt.calib_v[1]);
-    glob_opt.calib_v[2] = load_or_default(fs, "spectr", "CALIB_L3", glob_opt.calib_v[2]);
+    for (int i = 0; i < CALIB_POINTS_MAX; i++) {
+        glob_opt.calib_v[i] = load_or_default(fs, "spectr", "CALIB_L" + std::to_string(i + 1), glob_opt.calib_v[i]);
+    }
+    glob_opt.calib_order = std::clamp(load_or_default(fs, "spectr", "CALIB_ORDER", glob_opt.calib_order), 1, CALIB_POINTS_MAX - 1);
+    glob_opt.grid_from = load_or_default(fs, "spectr", "GRID_FROM", glob_opt.grid_from);
+    glob_opt.grid_to = load_or_default(fs, "spectr", "GRID_TO", glob_opt.grid_to);
+    glob_opt.grid_step = load_or_default(fs, "spectr", "GRID_STEP", glob_opt.grid_step);
     glob_opt.spectr_win_width = load_or_default(fs, "spectr", "WIN_WIDTH", glob_opt.spectr_win_width);
     glob_opt.spectr_win_height = load_or_default(fs, "spectr", "WIN_HEIGHT", glob_opt.spectr_win_height);
+    glob_opt.acc_frames_max = load_or_default(fs, "spectr", "ACC_FRAMES_MAX", glob_opt.acc_frames_max);
+    glob_opt.ref_frames = load_or_default(fs, "spectr", "REF_FRAMES", glob_opt.ref_frames);
+    glob_opt.history_size = std::max(0, load_or_default(fs, "spectr", "HISTORY", glob_opt.history_size));
     glob_opt.gain_step_val = load_or_default(fs, "control", "GAIN_STEP_VAL", glob_opt.gain_step_val);
     glob_opt.gain_steps = load_or_default(fs, "control", "GAIN_STEPS", glob_opt.gain_steps);
     glob_opt.exposure_limit[0] = load_or_default(fs, "control", "EXPOSURE_LIMIT_LOW", glob_opt.exposure_limit[0]);
     glob_opt.exposure_limit[1] = load_or_default(fs, "control", "EXPOSURE_LIMIT_HIGHT", glob_opt.exposure_limit[0]);
+    glob_opt.ring_size = load_or_default(fs, "pipeline", "RING_SIZE", glob_opt.ring_size);
+    glob_opt.ring_policy = load_or_default(fs, "pipeline", "RING_POLICY", glob_opt.ring_policy);
+    glob_opt.threads = load_or_default(fs, "pipeline", "THREADS", glob_opt.threads);
+    glob_opt.display_fps = std::max(1.0, load_or_default(fs, "pipeline", "DISPLAY_FPS", glob_opt.display_fps));
+    glob_opt.peak_threshold = load_or_default(fs, "peaks", "THRESHOLD", glob_opt.peak_threshold);
+    glob_opt.peak_fit = load_or_default(fs, "peaks", "FIT", glob_opt.peak_fit);
+    glob_opt.peak_max = load_or_default(fs, "peaks", "MAX", glob_opt.peak_max);
+    glob_opt.library_path = load_or_default(fs, "library", "PATH", glob_opt.library_path);
+    glob_opt.library_metric = load_or_default(fs, "library", "METRIC", glob_opt.library_metric);
+    glob_opt.library_top = std::max(1, load_or_default(fs, "library", "TOP_K", glob_opt.library_top));
+    if (!glob_opt.library_path.empty() && glob_opt.grid_step <= 0) {
+        // Сравнение с эталонами выполняется на равномерной сетке
+        glob_opt.grid_step = 1.0;
+        log1 << "Library matching requires uniform grid, GRID_STEP set to 1 nm" << std::endl;
+    }
+    glob_opt.ratio.dark_offset = load_or_default(fs, "ratio", "DARK_OFFSET", glob_opt.ratio.dark_offset);
+    glob_opt.ratio.min_ref = load_or_default(fs, "ratio", "MIN_REF", glob_opt.ratio.min_ref);
+    glob_opt.ratio.t_max = load_or_default(fs, "ratio", "T_MAX", glob_opt.ratio.t_max);
+    glob_opt.ratio.a_max = load_or_default(fs, "ratio", "A_MAX", glob_opt.ratio.a_max);
+    glob_opt.store_path = load_or_default(fs, "store", "PATH", glob_opt.store_path);
+    glob_opt.store_chunk_mb = std::max(1, load_or_default(fs, "store", "CHUNK_MB", glob_opt.store_chunk_mb));
+    glob_opt.store_index_step = std::max(1, load_or_default(fs, "store", "INDEX_STEP", glob_opt.store_index_step));
+    glob_opt.recall_span = load_or_default(fs, "store", "RECALL_SPAN", glob_opt.recall_span);
+    glob_opt.recall_max = std::max(1, load_or_default(fs, "store", "RECALL_MAX", glob_opt.recall_max));
+    glob_opt.record_path = load_or_default(fs, "", "record", glob_opt.record_path);
     
     capture = Capture::create(fs);
     if (!capture || capture->width() == 0 || capture->height() == 0) {
@@ -38,20 +81,76 @@ Controller::Controller(const std::string& config_file) : config_file(config_file
     options_file = get_user_dir() + std::string("\\spectr.options.yml");
     log1 << "Reading local user options from " << options_file;
     opt.load(options_file);
-    rotation = opt.rotation;
     model_video = std::make_unique<Model_Video>();
+#ifndef NDEBUG
+    if (!Model_Spectr::window_selftest()) {
+        log0 << "Sliding window self test failed" << std::endl;
+    }
+#endif
     model_spectr = std::make_unique<Model_Spectr>(opt.calib_points(), opt.spectr_acc_fps);
+    model_spectr->set_accumulation(static_cast<Model_Spectr::accumulation>(opt.spectr_acc_mode));
+    model_spectr->calibrate(opt.calib_points(), glob_opt.calib_order);
+    model_spectr->set_history(headless ? 0 : glob_opt.history_size);
+    tracks = std::make_unique<TrackSet>(*model_spectr, fs, opt.spectr_acc_fps);
+    auto pool = glob_opt.threads == 1 ? nullptr : std::make_shared<WorkerPool>(glob_opt.threads);
+    log1 << "Spectrum reduction threads: " << (pool ? pool->size() : 1) << std::endl;
+    tracks->set_pool(pool);
+    const cv::Mat dark = SpectrCorrection::load(opt.dark_ref);
+    const cv::Mat flat = SpectrCorrection::load(opt.flat_ref);
+    for (auto m : tracks->models()) {
+        m->set_channels(opt.show_channels);
+        m->get_correction().set_dark(dark);
+        m->get_correction().set_flat(flat);
+        m->set_correction(opt.correction);
+        m->set_uniform_grid(glob_opt.grid_from, glob_opt.grid_to, glob_opt.grid_step);
+        m->get_peak_tracker().set_options(glob_opt.peak_threshold, PeakTracker::parse_fit(glob_opt.peak_fit), glob_opt.peak_max);
+        m->set_peaks(opt.show_peaks);
+    }
+    if (!glob_opt.library_path.empty()) {
+        try {
+            auto library = std::make_shared<const SpectralLibrary>(glob_opt.library_path, glob_opt.grid_from, glob_opt.grid_to,
+                glob_opt.grid_step, SpectralLibrary::parse_metric(glob_opt.library_metric));
+            model_spectr->set_library(library, glob_opt.library_top);
+        }
+        catch (const std::exception& e) {
+            log0 << e.what() << std::endl;
+        }
+    }
+    if (!glob_opt.store_path.empty()) {
+        try {
+            model_spectr->set_store(std::make_shared<SpectrStore>(glob_opt.store_path,
+                static_cast<size_t>(glob_opt.store_chunk_mb) << 20, glob_opt.store_index_step));
+        }
+        catch (const std::exception& e) {
+            log0 << e.what() << std::endl;
+        }
+    }
+    if (headless) {
+        return;
+    }
+
     win_main = std::make_unique<MainWindow>(this);
-    view_video = std::make_shared<VideoView>(*win_main);
+    render = std::make_shared<RenderLoop>(glob_opt.display_fps);
+    view_video = std::make_shared<VideoView>(*win_main, glob_opt.spectr_win_width, glob_opt.spectr_win_height);
     view_video->showgrid(opt.showgrid);
-    model_video->subscribe(view_video);
+    model_video->subscribe(render);
+    render->attach(*model_video, view_video);
     view_spectr = std::make_shared<SpectrView>(*win_main, glob_opt.spectr_win_width, glob_opt.spectr_win_height);
-    model_spectr->subscribe(view_spectr);
+    view_spectr->show_noise(opt.show_noise);
+    view_spectr->show_peaks(opt.show_peaks);
+    view_spectr->set_ratio(static_cast<ratio_mode>(opt.spectr_ratio_mode), glob_opt.ratio);
+    view_spectr->set_tracks(tracks->extra());
+    view_waterfall = std::make_shared<WaterfallView>(*win_main, glob_opt.spectr_win_width, glob_opt.spectr_win_height);
+    model_spectr->subscribe(render);
+    render->attach(*model_spectr, view_spectr);
+    render->attach(*model_spectr, view_waterfall);
 }
 
 
 Controller::~Controller() {
-    opt.save(options_file);
+    if (!headless) {
+        opt.save(options_file);
+    }
 }
 
 
@@ -60,31 +159,199 @@ Capture& Controller::get_capture() {
 }
 
 
-/** Основной цикл приложения */
+/** Матрица поворота вокруг center на angle градусов (как cv::getRotationMatrix2D, но без выделения памяти) */
+static cv::Matx23d rotation_matrix(cv::Point2f center, double angle) {
+    const double a = std::cos(angle * CV_PI / 180.0);
+    const double b = std::sin(angle * CV_PI / 180.0);
+    return cv::Matx23d(a, b, (1 - a) * center.x - b * center.y,
+                       -b, a, b * center.x + (1 - a) * center.y);
+}
+
+
+/** Основной цикл приложения (поток интерфейса)
+ *  Кадры принимаются в отдельном потоке захвата (CaptureThread) и обрабатываются в потоке обработки
+ *  (process_loop), поэтому ни прием, ни обработка кадров не ждут отрисовки. Здесь обрабатываются события
+ *  окна и виды отрисовываются по последним опубликованным данным с частотой glob_opt.display_fps.
+ */
 int Controller::run() {
-    cv::Mat frame;
     win_main->create_controls();
     set_mode(mode::video);
-   
-    while (win_main->visible()) {
-        capture->read(frame);
-        cv::Mat filtered_frame;
+    std::unique_ptr<RawRecorder> recorder;
+    if (!glob_opt.record_path.empty()) {
+        recorder = std::make_unique<RawRecorder>(glob_opt.record_path);
+        log1 << "Recording frames to " << glob_opt.record_path << std::endl;
+    }
+    grabber = std::make_unique<CaptureThread>(*capture, glob_opt.ring_size,
+                                              FrameRing::policy_from_string(glob_opt.ring_policy),
+                                              std::move(recorder));
+    proc_roi = opt.roi();
+    proc_rotation = opt.rotation;
+    processing = std::thread(&Controller::process_loop, this);
+
+    while (win_main->visible() && !stop_processing) {
+        if (ref_ready.exchange(false)) {
+            finish_reference();
+        }
+        if (current_mode == mode::roi_selct && roi_ready.exchange(false)) {
+            select_roi();
+        }
+        render->tick();
+
+        int key = cv::waitKey(render->wait_ms());
+        if (key == ' ') {
+            set_mode(current_mode == mode::spectr ? mode::video : mode::spectr);
+        }
+        // else if (key == 'r') {
+        //     set_mode(mode::roi_selct);
+        // } 
+        else if (key>0) {
+            log1 << "Key pressed code "<< key<<std::endl;
+        };
+        
+    }
+    stop_processing = true;
+    processing.join();
+    grabber->stop();
+    auto st = grabber->stat();
+    log1 << "Frames produced " << st.produced << ", consumed " << st.consumed << ", dropped " << st.dropped << std::endl;
+    auto rs = render->stat();
+    log1 << "Display updates " << rs.updates << ", rendered " << rs.rendered << ", skipped " << rs.skipped << std::endl;
+    return 0;
+}
+
+
+/** Флаг остановки режима без окна по сигналу (SIGINT, SIGTERM) */
+static volatile std::sig_atomic_t stop_signal = 0;
+
+static void on_stop_signal(int) {
+    stop_signal = 1;
+}
+
+
+/** Рабочий цикл без окна: захват, окно и поворот из локальных настроек, расчет спектра
+ *  Кадры обрабатываются в вызывающем потоке без HighGUI. Опубликованные спектры пишутся в хранилище
+ *  (раздел store конфигурации) и в файл или стандартный вывод (h.output). Цикл завершается по пределу
+ *  кадров или времени либо по SIGINT/SIGTERM; итог (кадры, время, частота обработки) выводится в stderr.
+ */
+int Controller::run_headless(const HeadlessOptions& h) {
+    std::shared_ptr<SpectrCsvSink> sink;
+    if (!h.output.empty()) {
+        sink = std::make_shared<SpectrCsvSink>(h.output, h.data_out != nullptr ? *h.data_out : std::cout);
+        model_spectr->subscribe(sink);
+    }
+    std::unique_ptr<RawRecorder> recorder;
+    if (!glob_opt.record_path.empty()) {
+        recorder = std::make_unique<RawRecorder>(glob_opt.record_path);
+        log1 << "Recording frames to " << glob_opt.record_path << std::endl;
+    }
+    stop_signal = 0;
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+    proc_roi = opt.roi();
+    proc_rotation = opt.rotation;
+    current_mode = mode::spectr;
+    grabber = std::make_unique<CaptureThread>(*capture, glob_opt.ring_size,
+                                              FrameRing::policy_from_string(glob_opt.ring_policy),
+                                              std::move(recorder));
+
+    cv::Mat frame;  // буфер кадра используется повторно
+    uint64_t frames = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    int result = 0;
+    try {
+        while (!stop_signal && (h.frames == 0 || frames < h.frames) && (h.seconds <= 0 || elapsed < h.seconds)) {
+            if (grabber->read(frame, 100)) {
+                process_frame(frame);
+                frames++;
+            }
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+    catch (const std::exception& e) {
+        log0 << "Processing stopped: " << e.what() << std::endl;
+        result = 1;
+    }
+    grabber->stop();
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    if (sink) {
+        model_spectr->unsubscribe(sink);
+    }
+    auto st = grabber->stat();
+    std::cerr << fmt::format("Frames processed {} in {:.2f} s ({:.1f} fps), produced {}, dropped {}, spectra written {}\n",
+                             frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0, st.produced, st.dropped,
+                             sink ? sink->written() : 0);
+    return result;
+}
+
+
+/** Цикл потока обработки: прием кадров из CaptureThread и обновление моделей с частотой камеры */
+void Controller::process_loop() {
+    cv::Mat frame;  // буфер кадра используется повторно
+    try {
+        while (!stop_processing) {
+            apply_posted();
+            if (!grabber->read(frame, 100)) {
+                continue;
+            }
 
-        if (current_mode == mode::roi_selct) {
-            set_mode(mode::video);
-            win_main->overlayText("Задайте окно с помощью мыши и нажмите [Пробел] или [Ввод]", 0);
-            opt.set_roi(cv::selectROI(win_main->name(), frame, true));
-            log1 << "selected roi=" << opt.roi() << std::endl;
-            current_mode = mode::video;
-            win_main->overlayText("  ", 10);
-            continue;
+            if (current_mode == mode::roi_selct) {
+                // Окно выбирается мышью в потоке интерфейса на копии кадра
+                if (!roi_ready) {
+                    std::lock_guard<std::mutex> lock(handoff_mtx);
+                    frame.copyTo(roi_frame);
+                    roi_ready = true;
+                }
+                continue;
+            }
+
+            process_frame(frame);
         }
+    }
+    catch (const std::exception& e) {
+        log0 << "Processing stopped: " << e.what() << std::endl;
+        stop_processing = true;
+    }
+}
+
 
-        auto roi = opt.roi();
+/** Обработка кадра в текущем режиме: накопление опорного кадра и обновление моделей (поток обработки) */
+void Controller::process_frame(const cv::Mat& frame) {
+    if (ref_avg.active() && ref_avg.add(frame)) {
+        cv::Mat ref = ref_avg.result();
+        for (auto m : tracks->models()) {
+            if (ref_dark) {
+                m->get_correction().set_dark(ref);
+            }
+            else {
+                m->get_correction().set_flat(ref);
+            }
+        }
+        std::lock_guard<std::mutex> lock(handoff_mtx);
+        ref_result = ref;
+        ref_result_dark = ref_dark;
+        ref_ready = true;
+    }
+
+#ifndef NDEBUG
+    const uint64_t allocs_before = thread_heap_allocations();
+#endif
+    const cv::Rect roi = proc_roi;
+    const int rotation = proc_rotation;
+    const mode m = current_mode;
+    if (m == mode::spectr || m == mode::waterfall) {
+        // Окно и поворот применяются моделью спектра: повернутое изображение не строится
+        model_spectr->set_geometry(roi, rotation);
+        tracks->udpate_data(frame);
+    }
+    else if (m == mode::video) {
+        cv::Mat filtered_frame;
         if (rotation != 0 && roi == cv::Rect()) {
             // Поворот всего кадра
-            cv::Mat r = cv::getRotationMatrix2D(cv::Point2f(frame.cols / 2.F, frame.rows / 2.F), rotation, 1.0);
-            cv::warpAffine(frame, filtered_frame, r, frame.size()); 
+            auto r = rotation_matrix(cv::Point2f(frame.cols / 2.F, frame.rows / 2.F), rotation);
+            cv::warpAffine(frame, rotated, r, frame.size());
+            filtered_frame = rotated;
         }
         else if (rotation != 0 && roi != cv::Rect()) {
             // Поворот окна в кадре - выбираем область кадра вокруг окна (roi), чтобы после поворота не было черных полей
@@ -94,10 +361,10 @@ int Controller::run() {
                          cv::Point(min(frame.cols, (roi.br().x, brect.br().x)), min(frame.rows, max(roi.br().y, brect.br().y))) 
             );
             auto subframe = cv::Mat(frame, frect);
-            cv::Mat r = cv::getRotationMatrix2D(cv::Point2f(subframe.cols / 2.F, subframe.rows / 2.F), rotation, 1.0);
-            cv::warpAffine(subframe, filtered_frame, r, subframe.size());
+            auto r = rotation_matrix(cv::Point2f(subframe.cols / 2.F, subframe.rows / 2.F), rotation);
+            cv::warpAffine(subframe, rotated, r, subframe.size());
             cv::Rect roi_in_subframe( (frect.width-roi.width)/2, (frect.height-roi.height)/2, roi.width, roi.height);
-            filtered_frame = cv::Mat(filtered_frame, roi_in_subframe);
+            filtered_frame = cv::Mat(rotated, roi_in_subframe);
         }
         // Окно в кадре без поворотов
         else if (roi != cv::Rect()) {
@@ -106,48 +373,91 @@ int Controller::run() {
         else {
             filtered_frame = frame;
         }
-       
+        model_video->udpate_data(filtered_frame);
+    }
+#ifndef NDEBUG
+    // Контроль выделений памяти на кадр (после прогрева должно быть 0)
+    frame_allocs += thread_heap_allocations() - allocs_before;
+    if (++frames_processed % 300 == 0) {
+        log1 << "Heap allocations per frame: " << frame_allocs / 300.0 << std::endl;
+        frame_allocs = 0;
+    }
+#endif
+}
 
-        if (current_mode == mode::spectr) {
-            model_spectr->udpate_data(filtered_frame);
-        }
-        else if (current_mode == mode::video) {
-            model_video->udpate_data(filtered_frame);
-        }
 
-        int key = cv::waitKey(1);
-        if (key == ' ') {
-            set_mode(current_mode == mode::spectr ? mode::video : mode::spectr);
+/** Передача команды потоку обработки (выполняется перед обработкой следующего кадра) */
+void Controller::post(std::function<void()> cmd) {
+    std::lock_guard<std::mutex> lock(post_mtx);
+    posted.push_back(std::move(cmd));
+}
+
+
+/** Выполнение переданных команд (поток обработки) */
+void Controller::apply_posted() {
+    {
+        std::lock_guard<std::mutex> lock(post_mtx);
+        if (posted.empty()) {
+            return;
         }
-        // else if (key == 'r') {
-        //     set_mode(mode::roi_selct);
-        // } 
-        else if (key>0) {
-            log1 << "Key pressed code "<< key<<std::endl;
-        };
-        
+        posted_run.swap(posted);
     }
-    return 0;
+    for (auto& cmd : posted_run) {
+        cmd();
+    }
+    posted_run.clear();
+}
+
+
+/** Передача потоку обработки окна и угла поворота из локальных настроек */
+void Controller::post_geometry() {
+    post([this, roi = opt.roi(), angle = opt.rotation] {
+        proc_roi = roi;
+        proc_rotation = angle;
+    });
+}
+
+
+/** Выбор окна мышью на кадре, полученном от потока обработки (блокирует поток интерфейса до выбора) */
+void Controller::select_roi() {
+    set_mode(mode::video);
+    cv::Mat img;
+    {
+        std::lock_guard<std::mutex> lock(handoff_mtx);
+        img = roi_frame.clone();
+    }
+    win_main->overlayText("Задайте окно с помощью мыши и нажмите [Пробел] или [Ввод]", 0);
+    opt.set_roi(cv::selectROI(win_main->name(), img, true));
+    log1 << "selected roi=" << opt.roi() << std::endl;
+    post_geometry();
+    win_main->overlayText("  ", 10);
 }
 
 
 void Controller::set_mode(mode m) {
     log1 << "set__mode" << (int)m << std::endl;
+    view_spectr->deactivate();
+    view_waterfall->deactivate();
+    view_video->deactivate();
     if (m == mode::spectr) {
         view_spectr->activate();
-        view_video->deactivate();
+    }
+    else if (m == mode::waterfall) {
+        view_waterfall->activate();
     }
     else {
-        view_spectr->deactivate();
         view_video->activate();
-      
     };
+    if (m == mode::roi_selct) {
+        roi_ready = false;
+    }
     current_mode.store(m);
 }
 
 
 void Controller::reset_roi() {
     opt.set_roi(cv::Rect());
+    post_geometry();
 }
 
 
@@ -161,6 +471,90 @@ void Controller::spectr_memclear() {
 }
 
 
+/** Текущее время в мкс от начала эпохи (шкала времени хранилища спектров) */
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+/** Совпадение шкалы длин волн сохраненного спектра с текущей (шкала в хранилище - float)
+ * @param nm шкала сохраненного спектра
+ * @param data данные модели спектра (строка Model_Spectr::row_nm)
+ * @return наибольшее расхождение в нм или -1, если ширина спектров разная
+ */
+static double scale_mismatch(const std::vector<double>& nm, const cv::Mat& data) {
+    if (data.cols != static_cast<int>(nm.size())) {
+        return -1;
+    }
+    const double* cur = data.ptr<double>(Model_Spectr::row_nm);
+    double d = 0;
+    for (int i = 0; i < data.cols; i++) {
+        d = std::max(d, std::abs(cur[i] - nm[i]));
+    }
+    return d;
+}
+
+
+/** Загрузка в ячейку памяти (MS) среднего спектра из хранилища
+ *  Усредняется интервал длительностью glob_opt.recall_span, закончившийся opt.recall_minutes минут назад.
+ *  Спектр загружается, только если его ширина и шкала длин волн совпадают с текущими
+ *  (с точностью RECALL_NM_TOLERANCE нм).
+ */
+void Controller::spectr_memrecall() {
+    if (glob_opt.store_path.empty()) {
+        win_main->overlayText("Хранилище спектров не задано (раздел store конфигурации)", 3000);
+        return;
+    }
+    try {
+        SpectrStoreReader reader(glob_opt.store_path);
+        const int64_t to = now_us() - int64_t(opt.recall_minutes) * 60'000'000;
+        const int64_t from = to - static_cast<int64_t>(glob_opt.recall_span * 1e6);
+        std::vector<double> nm, mean;
+        auto snapshot = model_spectr->snapshot();
+        double mismatch = 0;
+        if (!reader.average(from, to, nm, mean)) {
+            win_main->overlayText("В хранилище нет спектров за этот интервал", 3000);
+        }
+        else if (!snapshot || (mismatch = scale_mismatch(nm, snapshot->data)) < 0) {
+            log0 << "Stored spectrum width " << mean.size() << " does not match current" << std::endl;
+            win_main->overlayText("Ширина сохраненного спектра не совпадает с текущей", 3000);
+        }
+        else if (mismatch > RECALL_NM_TOLERANCE) {
+            log0 << "Stored spectrum wavelength scale differs from current by " << mismatch << " nm" << std::endl;
+            win_main->overlayText("Калибровка сохраненного спектра не совпадает с текущей", 3000);
+        }
+        else {
+            model_spectr->spectr_memload(mean);
+        }
+    }
+    catch (const std::exception& e) {
+        log0 << e.what() << std::endl;
+    }
+}
+
+
+/** Экспорт спектров из хранилища за последние opt.recall_minutes минут (0 - все) в файл csv */
+void Controller::export_history() {
+    if (glob_opt.store_path.empty()) {
+        win_main->overlayText("Хранилище спектров не задано (раздел store конфигурации)", 3000);
+        return;
+    }
+    auto path = save_file_dialog();
+    if (path.empty())
+        return;
+    try {
+        SpectrStoreReader reader(glob_opt.store_path);
+        const int64_t to = now_us();
+        const int64_t from = opt.recall_minutes > 0 ? to - int64_t(opt.recall_minutes) * 60'000'000 : 0;
+        const size_t n = reader.write_csv(path, from, to);
+        log1 << "Exported " << n << " stored spectra" << std::endl;
+    }
+    catch (const std::exception& e) {
+        log0 << e.what() << std::endl;
+    }
+}
+
+
 void Controller::showgrid(int state) {
     opt.showgrid = state;
     view_video->showgrid(state);
@@ -169,21 +563,105 @@ void Controller::showgrid(int state) {
 
 void Controller::set_spectr_fps(int fps) {
     opt.spectr_acc_fps = fps;
-    model_spectr->set_acc_fps(fps);
+    post([this, fps] { model_spectr->set_acc_fps(fps); });
+}
+
+
+void Controller::set_accumulation(Model_Spectr::accumulation mode) {
+    opt.spectr_acc_mode = static_cast<int>(mode);
+    post([this, mode] { model_spectr->set_accumulation(mode); });
+}
+
+
+/** Начать накопление опорного кадра по glob_opt.ref_frames следующим кадрам
+ * @param dark true - темновой кадр (источник закрыт), false - кадр плоского поля (равномерная засветка)
+ */
+void Controller::capture_reference(bool dark) {
+    post([this, dark] {
+        ref_dark = dark;
+        ref_avg.start(glob_opt.ref_frames);
+    });
+    win_main->overlayText(dark ? "Запись темнового кадра..." : "Запись кадра плоского поля...", 2000);
+}
+
+
+/** Завершение накопления опорного кадра: сохранение в папке пользователя (в модели кадр передан потоком обработки) */
+void Controller::finish_reference() {
+    cv::Mat ref;
+    bool dark;
+    {
+        std::lock_guard<std::mutex> lock(handoff_mtx);
+        ref = ref_result;
+        dark = ref_result_dark;
+        ref_result.release();
+    }
+    std::string& path = dark ? opt.dark_ref : opt.flat_ref;
+    path = get_user_dir() + (dark ? "\\spectr.dark.yml.gz" : "\\spectr.flat.yml.gz");
+    if (!SpectrCorrection::save(path, ref)) {
+        path.clear();
+    }
+    log1 << (dark ? "Dark" : "Flat field") << " reference saved to " << path << std::endl;
+    win_main->overlayText(dark ? "Темновой кадр записан" : "Кадр плоского поля записан", 2000);
+}
+
+
+void Controller::set_correction(int state) {
+    opt.correction = state;
+    post([this, state] {
+        for (auto m : tracks->models()) {
+            m->set_correction(state);
+        }
+    });
+}
+
+
+void Controller::reset_correction() {
+    opt.dark_ref.clear();
+    opt.flat_ref.clear();
+    post([this] {
+        ref_avg.cancel();
+        for (auto m : tracks->models()) {
+            m->get_correction().set_dark(cv::Mat());
+            m->get_correction().set_flat(cv::Mat());
+        }
+    });
+}
+
+
+void Controller::show_noise(int state) {
+    opt.show_noise = state;
+    view_spectr->show_noise(state);
+}
+
+
+void Controller::show_peaks(int state) {
+    opt.show_peaks = state;
+    post([this, state] {
+        for (auto m : tracks->models()) {
+            m->set_peaks(state);
+        }
+    });
+    view_spectr->show_peaks(state);
+}
+
+
+void Controller::set_ratio(ratio_mode mode) {
+    opt.spectr_ratio_mode = static_cast<int>(mode);
+    view_spectr->set_ratio(mode, glob_opt.ratio);
 }
 
 
 void Controller::calibrate(int n)
 {
-    current_mode = mode::spectr;
+    set_mode(mode::spectr);
     auto callback = [this, n](int x) {
         int i = n - 1; 
-        if (i >= 0 || i<3 ) {
+        if (i >= 0 && i < CALIB_POINTS_MAX) {
             opt.calib_x[i] = x;
             opt.calib_v[i] = glob_opt.calib_v[i];
             log1 << "calib point " << i << " " << x << " " << glob_opt.calib_v[i] << std::endl;
         }
-        model_spectr->calibrate(opt.calib_points());
+        model_spectr->calibrate(opt.calib_points(), glob_opt.calib_order);
         
     };
     view_spectr->pick_X(callback);
@@ -191,41 +669,92 @@ void Controller::calibrate(int n)
 
 
 void Controller::reset_calibration() {
-    for (int i=0; i<3; i++){
+    for (int i=0; i<CALIB_POINTS_MAX; i++){
         opt.calib_x[i] = -1;
         opt.calib_v[i] = glob_opt.calib_v[i];         
     }
     model_spectr->spectr_memclear();
-    model_spectr->calibrate(opt.calib_points());
+    model_spectr->calibrate(opt.calib_points(), glob_opt.calib_order);
 }
 
 
 void Controller::export_spectr() {
-    if (current_mode != Controller::mode::spectr) {
+    if (current_mode != Controller::mode::spectr && current_mode != Controller::mode::waterfall) {
         win_main->overlayText("Для экспорта спектра включите отображение спектра", 3000);
         return;
     }
     auto path = save_file_dialog();
     if (path.empty())
         return;
-    std::ofstream f(path);
-    auto mat = model_spectr->get_data();
-    if (mat.rows <= 2) {
-        f << "nm;arb.u\n";
-        for (int i = 0; i < mat.cols; i++) {
-            f << fmt::format("{:.2f};{:.1f}\n", mat.at<double>(0, i), mat.at<double>(1, i));
+    if (auto snapshot = model_spectr->snapshot()) {
+        write_spectr_csv(path, *snapshot, static_cast<ratio_mode>(opt.spectr_ratio_mode), glob_opt.ratio);
+    }
+    // Дополнительные треки сохраняются в отдельные файлы: <имя>_<трек>.<расширение>
+    const std::filesystem::path base_path(path);
+    for (const auto& t : tracks->extra()) {
+        if (auto snapshot = t.model->snapshot()) {
+            std::filesystem::path track_path = base_path.parent_path() / base_path.stem();
+            track_path += "_" + t.name;
+            track_path += base_path.extension();
+            write_spectr_csv(track_path, *snapshot, static_cast<ratio_mode>(opt.spectr_ratio_mode), glob_opt.ratio);
         }
     }
-    else {
-        f << "nm;arb.u;arb.u(mem)\n";
-        for (int i = 0; i < mat.cols; i++) {
-            f << fmt::format("{:.2f};{:.1f};{:.1f}\n", mat.at<double>(0, i), mat.at<double>(1, i), mat.at<double>(2, i));
+}
+
+
+/** Запись снимка спектра в файл csv (разделитель ';')
+ *  Передискретизированный спектр записывается только в узлах сетки внутри шкалы спектра: значения
+ *  за ее пределами не измерены, и запись нулей выглядела бы как измеренный ноль.
+ */
+void Controller::write_spectr_csv(const std::filesystem::path& path, const Model_Spectr::Snapshot& snapshot,
+                                  ratio_mode ratio, const RatioOptions& ratio_opt) {
+    std::ofstream f(path);
+    // При заданной равномерной сетке длин волн экспортируется передискретизированный спектр
+    const cv::Mat& mat = snapshot.uniform.empty() ? snapshot.data : snapshot.uniform;
+    const int from = snapshot.uniform.empty() ? 0 : snapshot.covered_from;
+    const int to = snapshot.uniform.empty() ? mat.cols : snapshot.covered_to;
+    std::vector<int> rows = { Model_Spectr::row_nm, Model_Spectr::row_base };
+    f << "nm;arb.u";
+    if (snapshot.mem) {
+        rows.push_back(Model_Spectr::row_mem);
+        f << ";arb.u(mem)";
+    }
+    if (snapshot.channels) {
+        rows.insert(rows.end(), { Model_Spectr::row_red, Model_Spectr::row_green, Model_Spectr::row_blue });
+        f << ";R;G;B";
+    }
+    // Пропускание или оптическая плотность считаются только при экспорте в этих режимах
+    cv::Mat r_data;
+    if (ratio != ratio_mode::off && snapshot.mem) {
+        spectr_ratio(mat.row(Model_Spectr::row_base), snapshot.scale, mat.row(Model_Spectr::row_mem), snapshot.mem_scale,
+                     ratio, ratio_opt, r_data);
+        f << (ratio == ratio_mode::transmittance ? ";T" : ";A");
+    }
+    f << "\n";
+    for (int i = from; i < to; i++) {
+        f << fmt::format("{:.2f}", mat.at<double>(Model_Spectr::row_nm, i));
+        for (size_t r = 1; r < rows.size(); r++) {
+            f << fmt::format(";{:.1f}", mat.at<double>(rows[r], i));
+        }
+        if (!r_data.empty()) {
+            f << fmt::format(";{:.4f}", r_data.at<double>(i));
         }
+        f << "\n";
     }
 }
 
+void Controller::show_channels(int state) {
+    opt.show_channels = state;
+    post([this, state] {
+        for (auto m : tracks->models()) {
+            m->set_channels(state);
+        }
+    });
+}
+
 void Controller::set_rotation(int angle) {
-        opt.rotation = rotation = angle;
+    opt.rotation = angle;
+    post_geometry();
 }
 
 
@@ -243,12 +772,19 @@ void Controller::Options::load(std::string file_path) {
     rotation = load_or_default(fs, "CAMERA", "rotation", rotation);
     showgrid = load_or_default(fs, "CAMERA" , "showgrid", showgrid);
     spectr_acc_fps = load_or_default(fs, "", "spectr_acc_fps", spectr_acc_fps);
-    calib_x[0] = load_or_default(fs, "CALIBRATION", "calib_x1", calib_x[0]);
-    calib_v[0] = load_or_default(fs, "CALIBRATION", "calib_v1", calib_v[0]);
-    calib_x[1] = load_or_default(fs, "CALIBRATION", "calib_x2", calib_x[1]);
-    calib_v[1] = load_or_default(fs, "CALIBRATION", "calib_v2", calib_v[1]);
-    calib_x[2] = load_or_default(fs, "CALIBRATION", "calib_x3", calib_x[2]);
-    calib_v[2] = load_or_default(fs, "CALIBRATION", "calib_v3", calib_v[2]);
+    spectr_acc_mode = std::clamp(load_or_default(fs, "", "spectr_acc_mode", spectr_acc_mode), 0, 2);
+    show_noise = load_or_default(fs, "", "show_noise", show_noise);
+    show_peaks = load_or_default(fs, "", "show_peaks", show_peaks);
+    spectr_ratio_mode = std::clamp(load_or_default(fs, "", "spectr_ratio_mode", spectr_ratio_mode), 0, 2);
+    recall_minutes = std::max(0, load_or_default(fs, "", "recall_minutes", recall_minutes));
+    show_channels = load_or_default(fs, "", "show_channels", show_channels);
+    correction = load_or_default(fs, "CORRECTION", "enabled", correction);
+    dark_ref = load_or_default(fs, "CORRECTION", "dark", dark_ref);
+    flat_ref = load_or_default(fs, "CORRECTION", "flat", flat_ref);
+    for (int i = 0; i < CALIB_POINTS_MAX; i++) {
+        calib_x[i] = load_or_default(fs, "CALIBRATION", "calib_x" + std::to_string(i + 1), calib_x[i]);
+        calib_v[i] = load_or_default(fs, "CALIBRATION", "calib_v" + std::to_string(i + 1), calib_v[i]);
+    }
 }
 
 
@@ -270,14 +806,24 @@ void Controller::Options::save(std::string file_path) {
     fs.endWriteStruct();
 
     fs.write("spectr_acc_fps", spectr_acc_fps);
+    fs.write("spectr_acc_mode", spectr_acc_mode);
+    fs.write("show_noise", show_noise);
+    fs.write("show_peaks", show_peaks);
+    fs.write("spectr_ratio_mode", spectr_ratio_mode);
+    fs.write("recall_minutes", recall_minutes);
+    fs.write("show_channels", show_channels);
+
+    fs.startWriteStruct("CORRECTION", cv::FileNode::MAP);
+    fs.write("enabled", correction);
+    fs.write("dark", dark_ref);
+    fs.write("flat", flat_ref);
+    fs.endWriteStruct();
 
     fs.startWriteStruct("CALIBRATION",cv::FileNode::MAP);
-    fs.write("calib_x1", calib_x[0]);
-    fs.write("calib_v1", calib_v[0]);
-    fs.write("calib_x2", calib_x[1]);
-    fs.write("calib_v2", calib_v[1]);
-    fs.write("calib_x3", calib_x[2]);
-    fs.write("calib_v3", calib_v[2]);        
+    for (int i = 0; i < CALIB_POINTS_MAX; i++) {
+        fs.write("calib_x" + std::to_string(i + 1), calib_x[i]);
+        fs.write("calib_v" + std::to_string(i + 1), calib_v[i]);
+    }
     fs.endWriteStruct();
 }
 
@@ -302,7 +848,7 @@ void Controller::Options::set_roi(cv::Rect r) {
  */
 std::vector<std::pair<int, int>> Controller::Options::calib_points() {
     std::vector < std::pair<int, int>> pts;
-    for (int i=0; i<3; i++){
+    for (int i=0; i<CALIB_POINTS_MAX; i++){
         if (calib_v[i] > 0 && calib_x[i] >= 0) {
             bool dublicate_x = false;
             for (int j = 0; j < i; j++) {
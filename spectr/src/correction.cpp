@@ -0,0 +1,181 @@
+/**
+ * @file correction.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация коррекции спектра по опорным кадрам
+ */
+
+#include <algorithm>
+#include "correction.h"
+#include "optlog.h"
+
+/*---------------- FrameAverager --------------------------------*/
+
+/** Начать накопление среднего по frames кадрам */
+void FrameAverager::start(int frames) {
+    sum.release();
+    left = std::max(1, frames);
+    count = 0;
+}
+
+/** Добавить кадр
+ * @return true, если накоплено заданное количество кадров и результат готов
+ */
+bool FrameAverager::add(const cv::Mat& frame) {
+    if (left <= 0) {
+        return false;
+    }
+    if (!sum.empty() && (sum.size() != frame.size() || sum.channels() != frame.channels())) {
+        // Размер кадра изменился - накопление начинается заново
+        left += count;
+        count = 0;
+        sum.release();
+    }
+    if (sum.empty()) {
+        sum = cv::Mat::zeros(frame.size(), CV_64FC(frame.channels()));
+    }
+    cv::accumulate(frame, sum);
+    count++;
+    return --left == 0;
+}
+
+/** Средний кадр CV_32F с количеством каналов исходных кадров */
+cv::Mat FrameAverager::result() const {
+    cv::Mat r;
+    if (count > 0) {
+        sum.convertTo(r, CV_32F, 1.0 / count);
+    }
+    return r;
+}
+
+
+/*---------------- SpectrCorrection --------------------------------*/
+
+/** Установка темнового кадра (пустая матрица - без вычитания темнового кадра) */
+void SpectrCorrection::set_dark(cv::Mat ref) {
+    if (!ref.empty() && ref.channels() != 1 && ref.channels() != 3) {
+        log0 << "Dark frame with " << ref.channels() << " channels is not supported" << std::endl;
+        ref.release();
+    }
+    dark = ref;
+    valid = false;
+    mismatch = cv::Size();
+}
+
+/** Установка кадра плоского поля (пустая матрица - без коррекции плоского поля) */
+void SpectrCorrection::set_flat(cv::Mat ref) {
+    if (!ref.empty() && ref.channels() != 1 && ref.channels() != 3) {
+        log0 << "Flat field frame with " << ref.channels() << " channels is not supported" << std::endl;
+        ref.release();
+    }
+    flat = ref;
+    valid = false;
+    mismatch = cv::Size();
+}
+
+/** Спектр опорного кадра: яркость и каналы B, G, R по width ячеек */
+void SpectrCorrection::reference_bins(const cv::Mat& ref, std::vector<double>& bins) const {
+    bins.assign(4 * width, 0.0);
+    double* bgr[3] = { bins.data() + width, bins.data() + 2 * width, bins.data() + 3 * width };
+    projection.project(ref, bins.data(), bgr);
+    if (ref.channels() == 1) {
+        // Одноканальный опорный кадр одинаково корректирует все каналы
+        for (int c = 1; c < 4; c++) {
+            std::copy(bins.begin(), bins.begin() + width, bins.begin() + c * width);
+        }
+    }
+}
+
+/** Пересчет спектров опорных кадров для окна roi кадра размера frame_size, повернутого на angle градусов
+ *  Ничего не делает, если таблицы уже построены для этих параметров.
+ */
+void SpectrCorrection::prepare(cv::Size frame_size, cv::Rect roi, double angle) {
+    if (valid && projection.matches(frame_size, roi, angle)) {
+        return;
+    }
+    valid = false;
+    offset.clear();
+    gain.clear();
+    if ((!dark.empty() && dark.size() != frame_size) || (!flat.empty() && flat.size() != frame_size)) {
+        // Опорные кадры сохраняются до возврата к их размеру кадра
+        if (mismatch != frame_size) {
+            log0 << "Reference frame size does not match frame size " << frame_size << ", correction is off" << std::endl;
+            mismatch = frame_size;
+        }
+        return;
+    }
+    if (mismatch != cv::Size()) {
+        log0 << "Reference frame size matches frame size " << frame_size << " again, correction is on" << std::endl;
+        mismatch = cv::Size();
+    }
+    if (empty()) {
+        return;
+    }
+    projection.setup(frame_size, roi, angle);
+    width = projection.bins();
+
+    offset.assign(4 * width, 0.0);
+    if (!dark.empty()) {
+        reference_bins(dark, offset);
+    }
+    gain.assign(4 * width, 1.0);
+    if (!flat.empty()) {
+        std::vector<double> f;
+        reference_bins(flat, f);
+        for (int c = 0; c < 4; c++) {
+            double* g = gain.data() + c * width;
+            const double* o = offset.data() + c * width;
+            const double* p = f.data() + c * width;
+            double mean = 0;
+            for (int i = 0; i < width; i++) {
+                g[i] = p[i] - o[i];
+                mean += g[i];
+            }
+            mean /= width;
+            // Ячейки, в которые свет плоского поля практически не попадает, исключаются (коэффициент 0),
+            // чтобы не усиливать в них шум
+            for (int i = 0; i < width; i++) {
+                g[i] = g[i] > 0.01 * mean ? mean / g[i] : 0.0;
+            }
+        }
+    }
+    valid = true;
+}
+
+/** Коррекция спектра одного кадра
+ * @param luma спектр яркости из bins() элементов
+ * @param bgr nullptr или три спектра каналов B, G, R
+ */
+void SpectrCorrection::apply(double* luma, double* const* bgr) const {
+    if (!valid) {
+        return;
+    }
+    for (int c = 0; c < (bgr ? 4 : 1); c++) {
+        double* s = c == 0 ? luma : bgr[c - 1];
+        const double* o = offset.data() + c * width;
+        const double* g = gain.data() + c * width;
+        for (int i = 0; i < width; i++) {
+            s[i] = (s[i] - o[i]) * g[i];
+        }
+    }
+}
+
+/** Сохранение опорного кадра в файл FileStorage (рекомендуется расширение .yml.gz) */
+bool SpectrCorrection::save(const std::string& path, const cv::Mat& ref) {
+    cv::FileStorage fs;
+    if (!fs.open(path, cv::FileStorage::WRITE | cv::FileStorage::BASE64)) {
+        log0 << "Can't write reference frame to " << path << std::endl;
+        return false;
+    }
+    fs.write("frame", ref);
+    return true;
+}
+
+/** Загрузка опорного кадра из файла, пустая матрица при ошибке */
+cv::Mat SpectrCorrection::load(const std::string& path) {
+    cv::Mat ref;
+    cv::FileStorage fs;
+    if (!path.empty() && fs.open(path, cv::FileStorage::READ)) {
+        fs["frame"] >> ref;
+    }
+    return ref;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file decimation.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация пирамиды минимумов и максимумов
+ */
+
+#include <algorithm>
+#include <functional>
+#include "decimation.h"
+
+/** Построение пирамиды ряда y из n значений (ряд не копируется и должен существовать до следующего build) */
+void MinMaxPyramid::build(const double* y, int count) {
+    base = y;
+    n = count;
+    lo.clear();
+    hi.clear();
+    offset.assign(1, 0);
+    if (n <= 0) {
+        return;
+    }
+    // Уровень 1 - из исходного ряда
+    int m = (n + 1) / 2;
+    offset.push_back(0);
+    for (int j = 0; j < m; j++) {
+        const double a = y[2 * j];
+        const double b = 2 * j + 1 < n ? y[2 * j + 1] : a;
+        lo.push_back(std::min(a, b));
+        hi.push_back(std::max(a, b));
+    }
+    // Следующие уровни - из предыдущего, до одного блока
+    int prev = 0;
+    while (m > 1) {
+        const int pm = m;
+        m = (m + 1) / 2;
+        offset.push_back(static_cast<int>(lo.size()));
+        for (int j = 0; j < m; j++) {
+            const int a = prev + 2 * j;
+            const int b = 2 * j + 1 < pm ? a + 1 : a;
+            lo.push_back(std::min(lo[a], lo[b]));
+            hi.push_back(std::max(hi[a], hi[b]));
+        }
+        prev = offset.back();
+    }
+}
+
+/** Минимум и максимум значений с номерами от from до to (не включая to) */
+void MinMaxPyramid::range(int from, int to, double& rmin, double& rmax) const {
+    from = std::max(from, 0);
+    to = std::min(to, n);
+    if (from >= to) {
+        rmin = rmax = from < n ? base[from] : 0.0;
+        return;
+    }
+    rmin = base[from];
+    rmax = base[from];
+    const int levels = static_cast<int>(offset.size()) - 1;
+    for (int i = from; i < to;) {
+        // Наибольший уровень, блок которого начинается в i и не выходит за to
+        int k = 0;
+        while (k < levels && (i & ((2 << k) - 1)) == 0 && std::min(i + (2 << k), n) <= to) {
+            k++;
+        }
+        if (k == 0) {
+            rmin = std::min(rmin, base[i]);
+            rmax = std::max(rmax, base[i]);
+            i++;
+        }
+        else {
+            const int j = offset[k] + (i >> k);
+            rmin = std::min(rmin, lo[j]);
+            rmax = std::max(rmax, hi[j]);
+            i += 1 << k;
+        }
+    }
+}
+
+/** Разбиение точек монотонной (возрастающей или убывающей) шкалы на столбцы графика
+ *  Столбец c содержит точки с x от x0 + c * dx (включительно) до x0 + (c + 1) * dx, поэтому при нелинейной
+ *  шкале (калибровка в нм) столбцы содержат разное количество точек. Точки левее первого столбца
+ *  относятся к первому, правее последнего - к последнему. Границы ищутся двоичным поиском, O(cols * log n).
+ * @param dx ширина столбца (> 0)
+ * @param ranges номера точек столбцов [first, second), cols значений; пустой столбец - first == second
+ */
+void column_ranges(const double* x, int n, double x0, double dx, int cols, std::vector<std::pair<int, int>>& ranges) {
+    ranges.resize(cols);
+    if (n <= 0) {
+        std::fill(ranges.begin(), ranges.end(), std::make_pair(0, 0));
+        return;
+    }
+    const bool rising = x[n - 1] >= x[0];
+    // Номер первой точки с x >= v при возрастании шкалы или с x < v при убывании
+    auto bound = [x, n, rising](double v) {
+        return static_cast<int>((rising ? std::lower_bound(x, x + n, v) : std::upper_bound(x, x + n, v, std::greater<>())) - x);
+    };
+    int prev = rising ? 0 : n;
+    for (int c = 0; c < cols; c++) {
+        const int next = c + 1 < cols ? bound(x0 + (c + 1) * dx) : rising ? n : 0;
+        ranges[c] = rising ? std::make_pair(prev, next) : std::make_pair(next, prev);
+        prev = next;
+    }
+}
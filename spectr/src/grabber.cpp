@@ -0,0 +1,185 @@
+/**
+ * @file grabber.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация потока видеозахвата и кольцевого буфера кадров
+ */
+
+#include <chrono>
+#include <algorithm>
+#include "grabber.h"
+#include "optlog.h"
+
+/*---------------------- FrameRing --------------------------------*/
+
+/** Конструктор
+ * @param capacity количество слотов (буферов кадров) в кольце, не менее 1
+ * @param p политика при переполнении
+ * @param frame_size размер кадра для предварительного выделения буферов
+ * @param frame_type тип кадра (CV_8UC3 и т.п.)
+ */
+FrameRing::FrameRing(size_t capacity, policy p, cv::Size frame_size, int frame_type)
+    : slots(std::max<size_t>(capacity, 1)), pol(p) {
+    for (auto& s : slots) {
+        s.create(frame_size, frame_type);
+    }
+}
+
+/** Политика переполнения по имени из файла конфигурации (block, drop_oldest, keep_latest)
+ * @throw runtime_error
+ */
+FrameRing::policy FrameRing::policy_from_string(const std::string& name) {
+    if (name == "block") {
+        return policy::block;
+    }
+    else if (name == "drop_oldest") {
+        return policy::drop_oldest;
+    }
+    else if (name == "keep_latest") {
+        return policy::keep_latest;
+    }
+    throw std::runtime_error("Unknown ring policy '" + name + "'");
+}
+
+/** Возвращает слот для записи очередного кадра
+ *  При политике block ждет свободного слота, иначе при переполнении отбрасывает самый старый кадр.
+ *  Слот не виден потребителю до вызова end_write().
+ * @return указатель на буфер кадра или nullptr, если кольцо закрыто
+ */
+cv::Mat* FrameRing::begin_write() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (pol == policy::block) {
+        not_full.wait(lock, [this] { return count < slots.size() || closed; });
+    }
+    else if (count == slots.size()) {
+        head = (head + 1) % slots.size();
+        count--;
+        counters.dropped++;
+    }
+    if (closed) {
+        return nullptr;
+    }
+    return &slots[(head + count) % slots.size()];
+}
+
+/** Публикует кадр, записанный в слот, полученный от begin_write() */
+void FrameRing::end_write() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        count++;
+        counters.produced++;
+    }
+    not_empty.notify_one();
+}
+
+/** Забирает очередной кадр
+ * @param frame буфер потребителя, обменивается со слотом кольца
+ * @param timeout_ms максимальное время ожидания кадра
+ * @return false, если за время ожидания кадр не поступил или кольцо закрыто
+ */
+bool FrameRing::read(cv::Mat& frame, int timeout_ms) {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_empty.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count > 0 || closed; });
+        if (count == 0) {
+            return false;
+        }
+        if (pol == policy::keep_latest && count > 1) {
+            counters.dropped += count - 1;
+            head = (head + count - 1) % slots.size();
+            count = 1;
+        }
+        cv::swap(frame, slots[head]);
+        head = (head + 1) % slots.size();
+        count--;
+        counters.consumed++;
+    }
+    not_full.notify_one();
+    return true;
+}
+
+/** Закрывает кольцо: будит ожидающих производителя и потребителя */
+void FrameRing::close() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+    }
+    not_full.notify_all();
+    not_empty.notify_all();
+}
+
+/** Возвращает счетчики кадров */
+FrameRing::Stat FrameRing::stat() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return counters;
+}
+
+
+/*---------------------- CaptureThread --------------------------------*/
+
+/** Создает кольцо кадров размером ring_size и запускает поток захвата
+ * @param capture источник видеозахвата, должен существовать дольше объекта CaptureThread
+ * @param ring_size количество буферов кадров
+ * @param p политика при переполнении кольца
+ * @param recorder объект записи кадров в файл или nullptr
+ */
+CaptureThread::CaptureThread(Capture& capture, size_t ring_size, FrameRing::policy p,
+                             std::unique_ptr<RawRecorder> recorder)
+    : capture(capture), ring(ring_size, p, cv::Size(capture.width(), capture.height()), CV_8UC3),
+      recorder(std::move(recorder)) {
+    thread = std::thread(&CaptureThread::loop, this);
+}
+
+CaptureThread::~CaptureThread() {
+    stop();
+}
+
+/** Останавливает поток захвата и дожидается его завершения */
+void CaptureThread::stop() {
+    running = false;
+    ring.close();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/** Забирает очередной кадр из кольца, см. FrameRing::read() */
+bool CaptureThread::read(cv::Mat& frame, int timeout_ms) {
+    return ring.read(frame, timeout_ms);
+}
+
+/** Возвращает счетчики кадров кольца */
+FrameRing::Stat CaptureThread::stat() {
+    return ring.stat();
+}
+
+/** Рабочий цикл потока захвата */
+void CaptureThread::loop() {
+    RawFrameProps props;
+    uint64_t props_version = capture.props_version() - 1;
+    while (running) {
+        cv::Mat* slot = ring.begin_write();
+        if (slot == nullptr) {
+            break;
+        }
+        capture.read(*slot);
+        if (slot->empty()) {
+            log0 << "Empty frame from capture" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (recorder) {
+            // Параметры запрашиваются у драйвера только после их изменения
+            if (props_version != capture.props_version()) {
+                props_version = capture.props_version();
+                props.gain = capture.get_property("GAIN");
+                props.exposure = capture.get_property("EXPOSURE");
+                props.fourcc = static_cast<uint32_t>(capture.get_property("FOURCC"));
+            }
+            recorder->write(*slot, props);
+        }
+        ring.end_write();
+    }
+    if (recorder) {
+        log1 << "Recorded " << recorder->frames() << " frames" << std::endl;
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * @file history.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация истории опубликованных спектров
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "history.h"
+
+/** Задание емкости истории (0 - история не ведется). Накопленные строки сбрасываются */
+void SpectrHistory::set_capacity(int n) {
+    std::lock_guard<std::mutex> lock(mtx);
+    cap = std::max(0, n);
+    reset(0);
+}
+
+/** Сброс истории и выделение памяти под строки ширины n (вызывается под блокировкой) */
+void SpectrHistory::reset(int n) {
+    if (cap > 0 && n > 0) {
+        rows.create(cap, n, CV_32F);
+        times.assign(cap, 0.0);
+    }
+    else {
+        rows.release();
+        times.clear();
+    }
+    written.store(0, std::memory_order_release);
+    resets.fetch_add(1, std::memory_order_acq_rel);
+}
+
+/** Добавление спектра (только производитель)
+ * @param y спектр из n ячеек
+ * @param scale количество кадров, просуммированных в y
+ */
+void SpectrHistory::push(const double* y, int n, double scale) {
+    if (cap == 0 || n <= 0) {
+        return;
+    }
+    const double t = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(mtx);
+    if (rows.cols != n) {
+        reset(n);
+    }
+    const uint64_t index = written.load(std::memory_order_relaxed);
+    const int slot = static_cast<int>(index % cap);
+    const double k = 1.0 / std::max(scale, 1.0);
+    float* dst = rows.ptr<float>(slot);
+    for (int i = 0; i < n; i++) {
+        dst[i] = static_cast<float>(y[i] * k);
+    }
+    times[slot] = t;
+    written.store(index + 1, std::memory_order_release);
+}
+
+/** Ширина спектров в истории (0, если история пуста) */
+int SpectrHistory::width() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return rows.cols;
+}
+
+/** Количество действительных строк */
+int SpectrHistory::size() const {
+    return static_cast<int>(std::min<uint64_t>(count(), cap));
+}
+
+/** Копирование строки с номером index
+ * @param out буфер строки (используется повторно)
+ * @param time время записи строки, с (steady_clock), если не nullptr
+ * @return false, если строка еще не записана или уже вытеснена
+ */
+bool SpectrHistory::read(uint64_t index, std::vector<float>& out, double* time) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    const uint64_t n = written.load(std::memory_order_relaxed);
+    if (rows.empty() || index >= n || n - index > static_cast<uint64_t>(cap)) {
+        return false;
+    }
+    const int slot = static_cast<int>(index % cap);
+    const float* src = rows.ptr<float>(slot);
+    out.assign(src, src + rows.cols);
+    if (time != nullptr) {
+        *time = times[slot];
+    }
+    return true;
+}
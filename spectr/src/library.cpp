@@ -0,0 +1,343 @@
+/**
+ * @file library.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация библиотеки эталонных спектров
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "library.h"
+#include "calibration.h"
+#include "optlog.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+    #define DOT_X86 1
+    #include <immintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        #define TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+    #else
+        #define TARGET_AVX2_FMA
+    #endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define DOT_NEON 1
+    #include <arm_neon.h>
+#endif
+
+typedef float (*dot_fn)(const float* a, const float* b, int n);
+
+/*---------------------- Скалярные произведения --------------------------------*/
+
+static float dot_scalar(const float* a, const float* b, int n) {
+    float s = 0;
+    for (int i = 0; i < n; i++) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+#ifdef DOT_X86
+
+static float dot_sse2(const float* a, const float* b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i <= n - 8; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    alignas(16) float t[4];
+    _mm_store_ps(t, _mm_add_ps(s0, s1));
+    return t[0] + t[1] + t[2] + t[3] + dot_scalar(a + i, b + i, n - i);
+}
+
+static TARGET_AVX2_FMA float dot_avx2(const float* a, const float* b, int n) {
+    // Четыре независимых аккумулятора скрывают задержку FMA
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i <= n - 32; i += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), s3);
+    }
+    for (; i <= n - 8; i += 8) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    }
+    const __m256 s = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+    return _mm_cvtss_f32(h) + dot_scalar(a + i, b + i, n - i);
+}
+
+#endif
+
+#ifdef DOT_NEON
+
+static float dot_neon(const float* a, const float* b, int n) {
+    float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+    int i = 0;
+    for (; i <= n - 8; i += 8) {
+        s0 = vmlaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+        s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    const float32x4_t s = vaddq_f32(s0, s1);
+    return vgetq_lane_f32(s, 0) + vgetq_lane_f32(s, 1) + vgetq_lane_f32(s, 2) + vgetq_lane_f32(s, 3) +
+           dot_scalar(a + i, b + i, n - i);
+}
+
+#endif
+
+struct DotKernel {
+    const char* name;
+    dot_fn dot;
+};
+
+/** Выбор реализации по возможностям процессора */
+static DotKernel select_dot() {
+#if defined(DOT_X86)
+    if (cv::checkHardwareSupport(CV_CPU_AVX2) && cv::checkHardwareSupport(CV_CPU_FMA3)) {
+        return { "avx2", dot_avx2 };
+    }
+    if (cv::checkHardwareSupport(CV_CPU_SSE2)) {
+        return { "sse2", dot_sse2 };
+    }
+    return { "scalar", dot_scalar };
+#elif defined(DOT_NEON)
+    return { "neon", dot_neon };
+#else
+    return { "scalar", dot_scalar };
+#endif
+}
+
+static const DotKernel& dot_kernel() {
+    static const DotKernel k = select_dot();
+    return k;
+}
+
+
+/*---------------------- SpectralLibrary --------------------------------*/
+
+/** Загрузка библиотеки
+ * @param dir папка с файлами эталонов *.csv (имя эталона - имя файла без расширения)
+ * @param grid_from, grid_to, grid_step равномерная сетка длин волн, на которую передискретизируются эталоны
+ * @param m метрика сходства
+ */
+SpectralLibrary::SpectralLibrary(const std::string& dir, double grid_from, double grid_to, double grid_step, metric m)
+    : mode(m) {
+    std::error_code ec;
+    if (!std::filesystem::is_directory(dir, ec)) {
+        throw std::runtime_error("Spectral library directory not found: " + dir);
+    }
+    std::vector<std::filesystem::path> files;
+    for (const auto& e : std::filesystem::directory_iterator(dir, ec)) {
+        if (e.is_regular_file() && e.path().extension() == ".csv") {
+            files.push_back(e.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    UniformResampler grid;
+    grid.set_grid(grid_from, grid_to, grid_step);
+    if (!grid.enabled()) {
+        throw std::runtime_error("Bad wavelength grid for spectral library");
+    }
+    refs = cv::Mat::zeros(static_cast<int>(files.size()), grid.size(), CV_32F);
+    ref_sum.create(refs.rows, refs.cols + 1, CV_64F);
+    ref_sum2.create(refs.rows, refs.cols + 1, CV_64F);
+    std::vector<double> nm, val, row(grid.size());
+    int rows = 0;
+    for (const auto& path : files) {
+        if (!load_csv(path.string(), nm, val)) {
+            log0 << "Skip library spectrum " << path.string() << ": no data" << std::endl;
+            continue;
+        }
+        grid.build(nm.data(), static_cast<int>(nm.size()));
+        if (!grid.ready()) {
+            log0 << "Skip library spectrum " << path.string() << ": bad wavelength scale" << std::endl;
+            continue;
+        }
+        grid.apply(val.data(), row.data());
+        const int from = grid.covered_from(), to = grid.covered_to();
+        float* dst = refs.ptr<float>(rows);
+        std::fill(dst, dst + refs.cols, 0.0F);
+        std::copy(row.begin() + from, row.begin() + to, dst + from);
+        if (to - from < 2 || !normalize(dst + from, to - from)) {
+            log0 << "Skip library spectrum " << path.string() << ": flat spectrum or too narrow range" << std::endl;
+            continue;
+        }
+        prefix_sums(dst, refs.cols, ref_sum.ptr<double>(rows), ref_sum2.ptr<double>(rows));
+        cover_from.push_back(from);
+        cover_to.push_back(to);
+        names.push_back(path.stem().string());
+        rows++;
+    }
+    refs = refs.rowRange(0, rows).clone();
+    ref_sum = ref_sum.rowRange(0, rows).clone();
+    ref_sum2 = ref_sum2.rowRange(0, rows).clone();
+    log1 << "Spectral library " << dir << ": " << rows << " spectra x " << refs.cols << " points ("
+         << refs.total() * sizeof(float) / (1024 * 1024) << " MB), dot product: " << dot_isa() << std::endl;
+}
+
+/** Чтение файла эталона: длины волн (по возрастанию) и значения из первых двух столбцов
+ *  Разделитель - ';', ',' или табуляция; строки, не начинающиеся с числа (заголовок), пропускаются.
+ */
+bool SpectralLibrary::load_csv(const std::string& path, std::vector<double>& nm, std::vector<double>& val) const {
+    std::ifstream f(path);
+    std::vector<std::pair<double, double>> pts;
+    std::string line;
+    while (std::getline(f, line)) {
+        std::replace_if(line.begin(), line.end(), [](char c) { return c == ';' || c == ',' || c == '\t'; }, ' ');
+        std::istringstream ss(line);
+        double x, y;
+        if (ss >> x >> y) {
+            pts.emplace_back(x, y);
+        }
+    }
+    std::sort(pts.begin(), pts.end());
+    pts.erase(std::unique(pts.begin(), pts.end(), [](const auto& l, const auto& r) { return l.first == r.first; }), pts.end());
+    nm.clear();
+    val.clear();
+    for (const auto& p : pts) {
+        nm.push_back(p.first);
+        val.push_back(p.second);
+    }
+    return pts.size() >= 2;
+}
+
+/** Нормирование вектора по метрике библиотеки
+ * @return false, если вектор нельзя нормировать (постоянный или нулевой)
+ */
+bool SpectralLibrary::normalize(float* v, int n) const {
+    if (mode == metric::correlation) {
+        double mean = 0;
+        for (int i = 0; i < n; i++) {
+            mean += v[i];
+        }
+        mean /= n;
+        for (int i = 0; i < n; i++) {
+            v[i] = static_cast<float>(v[i] - mean);
+        }
+    }
+    double norm = 0;
+    for (int i = 0; i < n; i++) {
+        norm += double(v[i]) * v[i];
+    }
+    if (norm <= 0) {
+        return false;
+    }
+    const float k = static_cast<float>(1.0 / std::sqrt(norm));
+    for (int i = 0; i < n; i++) {
+        v[i] *= k;
+    }
+    return true;
+}
+
+/** Префиксные суммы значений и квадратов: sum[i], sum2[i] - суммы по v[0..i) (n + 1 элементов) */
+void SpectralLibrary::prefix_sums(const float* v, int n, double* sum, double* sum2) {
+    sum[0] = sum2[0] = 0;
+    for (int i = 0; i < n; i++) {
+        sum[i + 1] = sum[i] + v[i];
+        sum2[i + 1] = sum2[i] + double(v[i]) * v[i];
+    }
+}
+
+/** Сходство по суммам на пересечении из m узлов: xy - сумма произведений, x, y - суммы, x2, y2 - суммы квадратов
+ * @return от -1 до 1 или -2, если один из отрезков постоянный (нулевой)
+ */
+float SpectralLibrary::similarity(double xy, double x, double y, double x2, double y2, int m) const {
+    if (mode == metric::correlation) {
+        xy -= x * y / m;
+        x2 -= x * x / m;
+        y2 -= y * y / m;
+    }
+    const double d = x2 * y2;
+    return d > 0 ? static_cast<float>(std::clamp(xy / std::sqrt(d), -1.0, 1.0)) : -2.0F;
+}
+
+/** Поиск k наиболее похожих эталонов
+ * @param spectrum спектр на сетке библиотеки из n точек (n должно совпадать с bins())
+ * @param from, to диапазон узлов сетки, покрытых шкалой спектра (UniformResampler::covered_from/to)
+ * @param k количество результатов
+ * @param out результаты по убыванию сходства (пустой, если спектр не подходит)
+ * @param scratch рабочие буферы вызывающей стороны
+ * @param pool пул потоков или nullptr
+ */
+void SpectralLibrary::match(const double* spectrum, int n, int from, int to, int k, std::vector<LibraryMatch>& out,
+                            Scratch& scratch, WorkerPool* pool) const {
+    out.clear();
+    from = std::max(from, 0);
+    to = std::min(to, n);
+    if (n != refs.cols || refs.rows == 0 || k <= 0 || to - from < 2) {
+        return;
+    }
+    scratch.query.assign(n, 0.0F);
+    scratch.scores.resize(refs.rows);
+    scratch.sum.resize(static_cast<size_t>(n) + 1);
+    scratch.sum2.resize(static_cast<size_t>(n) + 1);
+    float* query = scratch.query.data();
+    float* scores = scratch.scores.data();
+    std::copy(spectrum + from, spectrum + to, query + from);
+    if (!normalize(query + from, to - from)) {
+        return;
+    }
+    prefix_sums(query, n, scratch.sum.data(), scratch.sum2.data());
+    const double* qs = scratch.sum.data();
+    const double* qs2 = scratch.sum2.data();
+    const int min_overlap = std::max(2, static_cast<int>(std::ceil(MIN_OVERLAP * (to - from))));
+
+    const dot_fn dot = dot_kernel().dot;
+    const int blocks = (refs.rows + MATCH_BLOCK_ROWS - 1) / MATCH_BLOCK_ROWS;
+    auto block = [&](int b) {
+        const int r1 = std::min(refs.rows, (b + 1) * MATCH_BLOCK_ROWS);
+        for (int r = b * MATCH_BLOCK_ROWS; r < r1; r++) {
+            const int a = std::max(from, cover_from[r]);
+            const int e = std::min(to, cover_to[r]);
+            if (e - a < min_overlap) {
+                scores[r] = -2.0F;
+                continue;
+            }
+            const double* rs = ref_sum.ptr<double>(r);
+            const double* rs2 = ref_sum2.ptr<double>(r);
+            const double xy = dot(refs.ptr<float>(r) + a, query + a, e - a);
+            scores[r] = similarity(xy, qs[e] - qs[a], rs[e] - rs[a], qs2[e] - qs2[a], rs2[e] - rs2[a], e - a);
+        }
+    };
+    if (pool != nullptr && blocks > 1) {
+        pool->run(blocks, block);
+    }
+    else {
+        for (int b = 0; b < blocks; b++) {
+            block(b);
+        }
+    }
+
+    // Отбор k лучших вставкой в упорядоченный список (k мало)
+    k = std::min(k, refs.rows);
+    for (int r = 0; r < refs.rows; r++) {
+        if (scores[r] < -1.0F) {
+            continue;  // нет достаточного пересечения или постоянный отрезок
+        }
+        if (static_cast<int>(out.size()) == k && scores[r] <= out.back().score) {
+            continue;
+        }
+        if (static_cast<int>(out.size()) == k) {
+            out.pop_back();
+        }
+        auto pos = std::find_if(out.begin(), out.end(), [s = scores[r]](const LibraryMatch& m) { return m.score < s; });
+        out.insert(pos, { &names[r], r, scores[r] });
+    }
+}
+
+/** Метрика по названию: correlation (по умолчанию) или cosine */
+SpectralLibrary::metric SpectralLibrary::parse_metric(const std::string& name) {
+    return name == "cosine" ? metric::cosine : metric::correlation;
+}
+
+/** Название используемой реализации скалярного произведения */
+const char* SpectralLibrary::dot_isa() {
+    return dot_kernel().name;
+}
@@ -21,21 +21,71 @@ int main(int argc, char** argv) {
 	else {
 		default_config_file = std::string(argv[0]) + ".yml";
 	}
-	if (argc > 1) {
-		config_file = std::string(argv[1]);
-		if (config_file == "--help" || config_file == "-h") {
-			std::cout << "Usage " << argv[0] << " [yaml_config_file]\n";
-			std::cout << "Default config file is " << default_config_file << std::endl;
-			return 0;
+	bool headless = false;
+	Controller::HeadlessOptions headless_opt;
+	try {
+		for (int i = 1; i < argc; i++) {
+			const std::string arg(argv[i]);
+			if (arg == "--help" || arg == "-h") {
+				std::cout << "Usage " << argv[0] << " [yaml_config_file] [--headless [--frames N] [--seconds S] [--output FILE]]\n";
+				std::cout << "Default config file is " << default_config_file << "\n";
+				std::cout << "  --headless   run without window: capture and spectrum calculation only, stop by Ctrl+C\n";
+				std::cout << "  --frames N   stop after N frames\n";
+				std::cout << "  --seconds S  stop after S seconds\n";
+				std::cout << "  --output F   write every spectrum to csv file F (\"-\" - standard output)" << std::endl;
+				return 0;
+			}
+			else if (arg == "--headless") {
+				headless = true;
+			}
+			else if ((arg == "--frames" || arg == "--seconds" || arg == "--output") && i + 1 < argc) {
+				const std::string val(argv[++i]);
+				if (arg == "--frames") {
+					headless_opt.frames = std::stoull(val);
+				}
+				else if (arg == "--seconds") {
+					headless_opt.seconds = std::stod(val);
+				}
+				else {
+					headless_opt.output = val;
+				}
+			}
+			else if (arg.rfind("--", 0) == 0) {
+				std::cerr << "Unknown or incomplete option " << arg << ", see --help\n";
+				return 1;
+			}
+			else {
+				config_file = arg;
+			}
 		}
 	}
-	else {
+	catch (const std::exception&) {
+		std::cerr << "Bad option value, see --help\n";
+		return 1;
+	}
+	if (config_file.empty()) {
 		config_file = default_config_file;
 	}
 
+	// Без окна стандартный вывод остается только для данных (--output -): журнал (log0, log1 пишут в std::cout)
+	// перенаправляется в std::cerr до создания контроллера, данные пишутся в исходный буфер std::cout
+	std::ostream data_out(std::cout.rdbuf());
+	struct RestoreCout {
+		std::streambuf* buf = nullptr;
+		~RestoreCout() {
+			if (buf != nullptr) {
+				std::cout.rdbuf(buf);
+			}
+		}
+	} restore_cout;
+	if (headless) {
+		restore_cout.buf = std::cout.rdbuf(std::cerr.rdbuf());
+		headless_opt.data_out = &data_out;
+	}
+
 	try {
-		Controller ctrl(config_file);
-		return ctrl.run();
+		Controller ctrl(config_file, headless);
+		return headless ? ctrl.run_headless(headless_opt) : ctrl.run();
 	}
 	catch (const cv::Exception& ex) {
 		std::cerr << "\nRuntime error:\n"<< ex.err << "\n";
@@ -1,5 +1,7 @@
 #include "model.h"
-#include <numeric> //accumulate
+#include <algorithm>
+#include <cmath>
+#include "colsum.h"
 #include "optlog.h"
 
 /*---------------- Model --------------------------------*/
@@ -31,15 +33,20 @@ void Model::notify() {
 
 /*---------------- Model Video --------------------------------*/
 
+/** Публикация кадра (копируется в свободный слот снимка без выделения памяти при неизменном размере) */
 void Model_Video::udpate_data(cv::Mat frame) {
-    data = frame;
+    frame_fps.tick();
+    auto s = snapshots.begin_write();
+    if (!s) {
+        return;
+    }
+    frame.copyTo(s->frame);
+    s->fps = frame_fps.fps();
+    s->version = snapshots.version() + 1;
+    snapshots.end_write();
     notify();
 }
 
-const cv::Mat& Model_Video::get_data() {
-    return data;
-}
-
 
 /*---------------- Model Spectr --------------------------------*/
 
@@ -49,31 +56,312 @@ const cv::Mat& Model_Video::get_data() {
  */
 Model_Spectr::Model_Spectr(std::vector<std::pair<int, int>> pts, long accumulate_frames)
     : calibr_pts(pts), accumulate_frames(accumulate_frames) {
+    log1 << "Column sum implementation: " << column_sum_isa() << std::endl;
+#ifndef NDEBUG
+    if (!column_sum_selftest()) {
+        log0 << "Column sum self test failed for " << column_sum_isa() << " implementation" << std::endl;
+    }
+#endif
 }
 
+// Масштаб фиксированной точки для спектров кадров в скользящем окне.
+// Значения хранятся в int64: после коррекции плоского поля (усиление до ~100) спектр 16-битного кадра
+// в масштабе 2^15 не помещается в int32. Значение ограничивается WINDOW_VALUE_MAX, поэтому сумма окна
+// до 2^17 кадров не переполняется.
+static const double WINDOW_FIXED_ONE = 1 << 15;
+static const double WINDOW_VALUE_MAX = 1 << 30;
+
 /** Установка количество калров по которым накапливается спектр */
 void Model_Spectr::set_acc_fps(int fps) {
     accumulate_frames = fps;
 }
 
-/** Обработка очередного видеокадра */
+/** Установка режима накопления спектра */
+void Model_Spectr::set_accumulation(accumulation mode) {
+    if (acc_mode == mode) {
+        return;
+    }
+    acc_mode = mode;
+    frames_counter = 0;
+    window_frames = 0;  // окно будет пересоздано при следующем кадре
+    if (!block_sum.empty()) {
+        block_sum.setTo(0);
+    }
+    reset_stats();
+}
+
+/** Установка окна (ROI) в кадре и угла поворота окна
+ * @param r окно в кадре, пустое - весь кадр
+ * @param a угол поворота в градусах. При повороте спектр строится проекцией (Projection)
+ *          без построения повернутого изображения
+ */
+void Model_Spectr::set_geometry(cv::Rect r, int a) {
+    roi = r;
+    angle = a;
+}
+
+/** Окно спектра в кадре размера frame_size: окно set_geometry(), ограниченное кадром; весь кадр, если окно не задано
+ * @return пустой прямоугольник, если заданное окно не пересекается с кадром
+ */
+cv::Rect Model_Spectr::frame_rect(cv::Size frame_size) const {
+    const cv::Rect frame(cv::Point(), frame_size);
+    return roi == cv::Rect() ? frame : roi & frame;
+}
+
+/** Обработка очередного видеокадра
+ * @param frame полный кадр; окно и поворот задаются set_geometry()
+ */
 void Model_Spectr::udpate_data(cv::Mat frame) {
+    const cv::Rect r = frame_rect(frame.size());
+    if (r.empty()) {
+        return;  // окно вне кадра
+    }
+    begin_frame(r.width);
+
+    // Спектр текущего кадра
+    if (angle != 0) {
+        const Projection::Target t = projection_target(frame.size(), r);
+        Projection::project_many(frame, &t, 1, pool.get());
+    }
+    else {
+        // Суммы по столбцам считаются сразу по каналам исходного кадра, без промежуточного изображения в оттенках серого
+        cv::Mat img(frame, r);
+        reduce_columns(img);
+        add_column_sums(col_sums.data(), img.channels(), img.rows);
+    }
+    end_frame(frame.size(), frame.channels(), r);
+}
+
+/** Начало обработки кадра, спектр которого проецируется вызывающей стороной вместе с другими окнами
+ *  (окно с поворотом, TrackSet). После проекции вызывается udpate_projected().
+ * @return окно для Projection::project_many
+ */
+Projection::Target Model_Spectr::begin_projected(cv::Size frame_size) {
+    const cv::Rect r = frame_rect(frame_size);
+    begin_frame(r.width);
+    return projection_target(frame_size, r);
+}
+
+/** Завершение обработки кадра после проекции окна, полученного begin_projected() */
+void Model_Spectr::udpate_projected(cv::Size frame_size, int cn) {
+    end_frame(frame_size, cn, frame_rect(frame_size));
+}
+
+/** Проекция окна r кадра размера frame_size в spectr (таблицы перестраиваются при изменении окна или угла) */
+Projection::Target Model_Spectr::projection_target(cv::Size frame_size, cv::Rect r) {
+    if (!projection.matches(frame_size, r, angle)) {
+        projection.setup(frame_size, r, angle);
+    }
+    proj_bgr[0] = spectr.ptr<double>(row_blue);
+    proj_bgr[1] = spectr.ptr<double>(row_green);
+    proj_bgr[2] = spectr.ptr<double>(row_red);
+    return { &projection, spectr.ptr<double>(row_base), channels ? proj_bgr : nullptr };
+}
 
-    // Первый вызов функции 
-    static int prev_frame_cols = -1;
-    if (frame.cols != prev_frame_cols) {
-        prev_frame_cols = frame.cols;
-        data = cv::Mat::zeros(data_rows, frame.cols, CV_64F);
-        spectr = cv::Mat::zeros(1, frame.cols, CV_64F);
-        calibrate(calibr_pts);
+/** Обработка очередного кадра по готовым суммам столбцов окна (окно без поворота)
+ *  Используется, когда суммы нескольких окон считаются за один проход по кадру (TrackSet).
+ * @param sums суммы по столбцам окна r, по cn значений на столбец
+ * @param frame_size размер кадра
+ * @param cn количество каналов кадра
+ * @param r окно, по которому посчитаны суммы (frame_rect())
+ */
+void Model_Spectr::udpate_sums(const uint32_t* sums, cv::Size frame_size, int cn, cv::Rect r) {
+    begin_frame(r.width);
+    add_column_sums(sums, cn, r.height);
+    end_frame(frame_size, cn, r);
+}
+
+/** Подготовка к обработке кадра: команды интерфейса и (пере)создание буферов при изменении ширины окна */
+void Model_Spectr::begin_frame(int width) {
+    apply_commands();
+    if (width != data.cols || data.empty()) {
+        data = cv::Mat::zeros(data_rows, width, CV_64F);
+        spectr = cv::Mat::zeros(data_rows, width, CV_64F);
+        block_sum = cv::Mat::zeros(data_rows, width, CV_64F);
+        ema = cv::Mat::zeros(data_rows, width, CV_64F);
+        apply_calibration();
         frames_counter = 0;
+        reset_stats();
+    }
+}
+
+/** Завершение обработки кадра, спектр которого находится в spectr: коррекция, накопление, публикация */
+void Model_Spectr::end_frame(cv::Size frame_size, int cn, cv::Rect r) {
+    frame_fps.tick();
+    if (correct && !correction.empty()) {
+        // Коррекция по опорным кадрам выполняется над спектром кадра, а не над пикселями
+        correction.prepare(frame_size, r, angle);
+        double* bgr[3] = { spectr.ptr<double>(row_blue), spectr.ptr<double>(row_green), spectr.ptr<double>(row_red) };
+        correction.apply(spectr.ptr<double>(row_base), channels && cn == 3 ? bgr : nullptr);
     }
 
-    cv::Mat img;
-    cv::cvtColor(frame, img, cv::COLOR_BGR2GRAY);
-    for (int i = 0; i < img.cols; i++) {
-        cv::Mat column = img.col(i);
-        spectr.at<double>(0, i) += std::accumulate(column.begin<uchar>(), column.end<uchar>(), 0) / img.rows;
+    // Накопление и статистика по ячейкам
+    bool publish = true;
+    switch (acc_mode) {
+    case accumulation::block:
+        publish = accumulate_block();
+        break;
+    case accumulation::sliding:
+        push_window();
+        data_scale = 1;
+        break;
+    case accumulation::ema:
+        accumulate_ema();
+        data_scale = 1;
+        break;
+    }
+    spectr.setTo(0);
+    if (publish) {
+        publish_snapshot();
+        notify();
+    }
+}
+
+/** Публикация копии data (вместе с флагами) как нового неизменяемого снимка для читателей
+ *  Если все слоты буфера удерживаются читателями, публикация пропускается - производитель не ждет.
+ */
+void Model_Spectr::publish_snapshot() {
+    // Пики ищутся в каждом публикуемом спектре, даже если публикация будет пропущена, - для непрерывного сопровождения
+    if (find_peaks) {
+        peak_tracker.update(data.ptr<double>(row_base), data.cols);
+    }
+    else {
+        peak_tracker.reset();
+    }
+    history.push(data.ptr<double>(row_base), data.cols, data_scale);
+    if (store) {
+        store->append(data.ptr<double>(row_nm), data.ptr<double>(row_base), data.cols, data_scale, calib_version);
+    }
+    Snapshot* s = snapshots.begin_write();
+    if (s == nullptr) {
+        return;
+    }
+    data.copyTo(s->data);
+    // Пирамиды минимумов и максимумов для графиков - один раз на снимок, а не при каждой отрисовке
+    s->lod[row_base].build(s->data.ptr<double>(row_base), s->data.cols);
+    if (mem_spectr) {
+        s->lod[row_mem].build(s->data.ptr<double>(row_mem), s->data.cols);
+    }
+    if (channels) {
+        for (int row = row_red; row <= row_blue; row++) {
+            s->lod[row].build(s->data.ptr<double>(row), s->data.cols);
+        }
+    }
+    s->noise.create(2, s->data.cols, CV_64F);
+    cv::Mat noise_lo = s->noise.row(0), noise_hi = s->noise.row(1);
+    cv::subtract(s->data.row(row_base), s->data.row(row_std), noise_lo);
+    cv::add(s->data.row(row_base), s->data.row(row_std), noise_hi);
+    s->lod_noise[0].build(noise_lo.ptr<double>(), s->noise.cols);
+    s->lod_noise[1].build(noise_hi.ptr<double>(), s->noise.cols);
+    if (resampler.ready()) {
+        // Передискретизация действительных строк; шкала сетки (row_nm) заполняется при создании буфера
+        const int n = resampler.size();
+        if (s->uniform.rows != data_rows || s->uniform.cols != n) {
+            s->uniform = cv::Mat::zeros(data_rows, n, CV_64F);
+            for (int k = 0; k < n; k++) {
+                s->uniform.at<double>(row_nm, k) = resampler.grid(k);
+            }
+        }
+        for (int row = row_base; row < data_rows; row++) {
+            const bool valid = row == row_base || row == row_std || (row == row_mem && mem_spectr) ||
+                               (row >= row_red && channels);
+            if (valid) {
+                resampler.apply(data.ptr<double>(row), s->uniform.ptr<double>(row));
+            }
+        }
+    }
+    else {
+        s->uniform.release();
+    }
+    s->covered_from = s->uniform.empty() ? 0 : resampler.covered_from();
+    s->covered_to = s->uniform.empty() ? 0 : resampler.covered_to();
+    // Сравнение с библиотекой эталонов на равномерной сетке
+    if (library && !s->uniform.empty()) {
+        library->match(s->uniform.ptr<double>(row_base), s->uniform.cols, s->covered_from, s->covered_to,
+                       library_top, s->matches, match_scratch, pool.get());
+    }
+    else {
+        s->matches.clear();
+    }
+    s->peaks.assign(peak_tracker.peaks().begin(), peak_tracker.peaks().end());
+    for (auto& p : s->peaks) {
+        p.nm = calibration.empty() ? p.bin : calibration(p.bin);
+    }
+    s->mem = mem_spectr;
+    s->channels = channels;
+    s->scale = data_scale;
+    s->mem_scale = mem_scale;
+    s->fps = frame_fps.fps();
+    s->version = snapshots.version() + 1;
+    snapshots.end_write();
+}
+
+/** Выполнение команд, поступивших через spectr_memset(), spectr_memclear(), spectr_memload() и calibrate()
+ *  Команды изменяют только рабочие данные производителя и попадают к читателям со следующим снимком.
+ */
+void Model_Spectr::apply_commands() {
+    if (!cmd_pending.exchange(false)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cmd_mtx);
+    if (cmd_calibrate) {
+        cmd_calibrate = false;
+        calibr_pts = cmd_calibr_pts;
+        calibr_order = cmd_calibr_order;
+        apply_calibration();
+    }
+    if (cmd_mem == mem_cmd::set && !data.empty()) {
+        data.row(row_base).copyTo(data.row(row_mem));
+        mem_scale = data_scale;
+        mem_spectr = true;
+    }
+    else if (cmd_mem == mem_cmd::clear) {
+        mem_spectr = false;
+    }
+    else if (cmd_mem == mem_cmd::load && !data.empty()) {
+        if (static_cast<int>(cmd_mem_values.size()) == data.cols) {
+            // Спектр из хранилища приводится к масштабу текущего накопления
+            double* mem = data.ptr<double>(row_mem);
+            for (int i = 0; i < data.cols; i++) {
+                mem[i] = cmd_mem_values[i] * data_scale;
+            }
+            mem_scale = data_scale;
+            mem_spectr = true;
+        }
+        else {
+            log0 << "Stored spectrum width " << cmd_mem_values.size() << " doesn't match current " << data.cols << std::endl;
+        }
+    }
+    cmd_mem = mem_cmd::none;
+}
+
+/** Сброс статистики разброса по ячейкам спектра */
+void Model_Spectr::reset_stats() {
+    stat_n = 0;
+    stat_mean.assign(spectr.cols, 0.0);
+    stat_m2.assign(spectr.cols, 0.0);
+}
+
+/** Накопление суммы спектров по accumulate_frames кадрам
+ *  Одновременно по алгоритму Уэлфорда считаются среднее и дисперсия яркости кадров в каждой ячейке.
+ * @return true, если блок накоплен и опубликован в data
+ */
+bool Model_Spectr::accumulate_block() {
+    const int rows = channels ? 4 : 1;
+    stat_n++;
+    for (int w = 0; w < rows; w++) {
+        const double* src = spectr.ptr<double>(spectr_row(w));
+        double* dst = block_sum.ptr<double>(spectr_row(w));
+        for (int i = 0; i < spectr.cols; i++) {
+            dst[i] += src[i];
+        }
+        if (w == 0) {
+            for (int i = 0; i < spectr.cols; i++) {
+                const double d = src[i] - stat_mean[i];
+                stat_mean[i] += d / stat_n;
+                stat_m2[i] += d * (src[i] - stat_mean[i]);
+            }
+        }
     }
 
     if (accumulate_frames != 0) {
@@ -82,93 +370,330 @@ void Model_Spectr::udpate_data(cv::Mat frame) {
     else {
         frames_counter = 0;
     }
+    if (frames_counter != 0) {
+        return false;
+    }
 
-    if (frames_counter == 0) {
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            memcpy(data.ptr<void>(row_base), spectr.ptr<void>(0), sizeof(double) * data.cols);
-
-            // "Вычилсение Спектр" / "Сохраненный спектр"
-            //  Закоментировано, так как пока не понятно, как лучше отображать резльтат и полезен ли такой расчет
-            // if (mem_spectr) {
-            //     memcpy(data.ptr<void>(row_bdm), spectr.ptr<void>(0), sizeof(double) * data.cols);
-            //     auto bdm = data.ptr<double>(row_bdm);
-            //     auto mem = data.ptr<double>(row_mem);
-            //     for (int i = 0; i < data.cols; i++) {
-            //         if (mem[i] > 1) {
-            //             bdm[i] = bdm[i] / mem[i];
-            //         } 
-            //     }
-            // }
-        }
-        spectr = cv::Mat::zeros(1, data.cols, CV_64F);
-        notify();
+    {
+        for (int w = 0; w < rows; w++) {
+            block_sum.row(spectr_row(w)).copyTo(data.row(spectr_row(w)));
+        }
+        // Опубликованный спектр - сумма stat_n кадров, разброс приводится к тому же масштабу
+        double* sd = data.ptr<double>(row_std);
+        for (int i = 0; i < data.cols; i++) {
+            sd[i] = stat_n > 1 ? std::sqrt(stat_m2[i] / (stat_n - 1)) * stat_n : 0.0;
+        }
+        data_scale = stat_n;
     }
+    block_sum.setTo(0);
+    reset_stats();
+    return true;
 }
 
-/** Сохранить (запомнить) текущий (последний накопленный) спектр */
-void Model_Spectr::spectr_memset() {
-    if (!data.empty()) {
-        std::lock_guard<std::mutex> lock(mtx);
-        memcpy(data.ptr<void>(row_mem), data.ptr<void>(row_base), sizeof(double) * data.cols);
-        mem_spectr = true;
+/** Экспоненциальное скользящее среднее с постоянной времени accumulate_frames кадров
+ *  Для яркости одновременно считается экспоненциально взвешенная дисперсия (инкрементальная форма Уэлфорда).
+ */
+void Model_Spectr::accumulate_ema() {
+    const double alpha = 2.0 / (std::max(1, accumulate_frames) + 1);
+    const int rows = channels ? 4 : 1;
+    for (int w = 0; w < rows; w++) {
+        const double* src = spectr.ptr<double>(spectr_row(w));
+        double* e = ema.ptr<double>(spectr_row(w));
+        if (stat_n == 0) {
+            std::copy(src, src + spectr.cols, e);
+        }
+        else if (w == 0) {
+            for (int i = 0; i < spectr.cols; i++) {
+                const double d = src[i] - e[i];
+                const double incr = alpha * d;
+                e[i] += incr;
+                stat_m2[i] = (1.0 - alpha) * (stat_m2[i] + d * incr);
+            }
+        }
+        else {
+            for (int i = 0; i < spectr.cols; i++) {
+                e[i] += alpha * (src[i] - e[i]);
+            }
+        }
+    }
+    stat_n++;
+
+    for (int w = 0; w < rows; w++) {
+        ema.row(spectr_row(w)).copyTo(data.row(spectr_row(w)));
+    }
+    double* sd = data.ptr<double>(row_std);
+    for (int i = 0; i < data.cols; i++) {
+        sd[i] = std::sqrt(stat_m2[i]);
     }
 }
 
-/** Очистка сохраненного спектра */
-void Model_Spectr::spectr_memclear() {
-    mem_spectr = false;
+/** Пересоздание пустого скользящего окна по текущим размеру, ширине спектра и набору каналов */
+void Model_Spectr::reset_window() {
+    window_frames = std::max(1, accumulate_frames);
+    window_rows = channels ? 4 : 1;
+    const size_t frame_len = static_cast<size_t>(window_rows) * spectr.cols;
+    window.assign(frame_len * window_frames, 0);
+    window_sum.assign(frame_len, 0);
+    window_pos = 0;
+    window_count = 0;
+    reset_stats();
 }
 
-/** Возваращает данные модели 
-    Матрица в две строки - если нет сохраненного спектра
-    Полная матрица - если есть сохраненный спектр
-*/
-const cv::Mat& Model_Spectr::get_data() {
-    if (mem_spectr == false) {
-        data_short = cv::Mat(data, cv::Range(0, 2));
-        return data_short;
+/** Добавляет спектр текущего кадра (spectr) в скользящее окно, вытесняя самый старый кадр,
+ *  и публикует среднее по окну
+ *  Дисперсия яркости по окну обновляется за O(1) (формула Уэлфорда для добавления и замены значения),
+ *  средние до и после обновления берутся из точной целочисленной суммы.
+ */
+void Model_Spectr::push_window() {
+    if (window_frames != std::max(1, accumulate_frames) || window_rows != (channels ? 4 : 1) ||
+        window_sum.size() != static_cast<size_t>(window_rows) * spectr.cols) {
+        reset_window();
+    }
+    const int cols = spectr.cols;
+    const bool full = window_count == window_frames;
+    const int count = std::min(window_count + 1, window_frames);
+    int64_t* slot = window.data() + static_cast<size_t>(window_pos) * window_rows * cols;
+    for (int w = 0; w < window_rows; w++) {
+        const double* src = spectr.ptr<double>(spectr_row(w));
+        int64_t* old = slot + static_cast<size_t>(w) * cols;
+        int64_t* sum = window_sum.data() + static_cast<size_t>(w) * cols;
+        for (int i = 0; i < cols; i++) {
+            const int64_t q = std::llround(std::clamp(src[i], -WINDOW_VALUE_MAX, WINDOW_VALUE_MAX) * WINDOW_FIXED_ONE);
+            if (w == 0) {
+                const double x = q / WINDOW_FIXED_ONE;
+                const double mean_old = window_count > 0 ? sum[i] / (WINDOW_FIXED_ONE * window_count) : 0.0;
+                const double mean_new = (sum[i] + q - old[i]) / (WINDOW_FIXED_ONE * count);
+                if (full) {
+                    const double x_old = old[i] / WINDOW_FIXED_ONE;
+                    stat_m2[i] += (x - x_old) * (x - mean_new + x_old - mean_old);
+                }
+                else {
+                    stat_m2[i] += (x - mean_old) * (x - mean_new);
+                }
+                stat_m2[i] = std::max(0.0, stat_m2[i]);
+            }
+            sum[i] += q - old[i];
+            old[i] = q;
+        }
+    }
+    window_pos = (window_pos + 1) % window_frames;
+    window_count = count;
+
+    const double k = 1.0 / (WINDOW_FIXED_ONE * window_count);
+    for (int w = 0; w < window_rows; w++) {
+        double* dst = data.ptr<double>(spectr_row(w));
+        const int64_t* sum = window_sum.data() + static_cast<size_t>(w) * cols;
+        for (int i = 0; i < cols; i++) {
+            dst[i] = sum[i] * k;
+        }
+    }
+    double* sd = data.ptr<double>(row_std);
+    for (int i = 0; i < cols; i++) {
+        sd[i] = window_count > 1 ? std::sqrt(stat_m2[i] / (window_count - 1)) : 0.0;
+    }
+}
+
+/** Установка пула потоков для обработки кадра (nullptr - однопоточная обработка)
+ *  Пул может использоваться несколькими моделями, обрабатывающими кадр последовательно.
+ */
+void Model_Spectr::set_pool(std::shared_ptr<WorkerPool> p) {
+    pool = p;
+}
+
+/** Суммирование окна кадра по столбцам в col_sums
+ *  Большое окно делится на полосы по Projection::BAND_ROWS строк, которые суммируются параллельно
+ *  в отдельные буферы и затем складываются в порядке номеров полос.
+ */
+void Model_Spectr::reduce_columns(const cv::Mat& img) {
+    static const int PARALLEL_MIN_PIXELS = 256 * 1024;
+    const int n = img.cols * img.channels();
+    const int bands = (img.rows + Projection::BAND_ROWS - 1) / Projection::BAND_ROWS;
+    col_sums.assign(n, 0);
+    if (!pool || pool->size() == 1 || bands < 2 || img.total() < static_cast<size_t>(PARALLEL_MIN_PIXELS)) {
+        column_sum(img, col_sums.data());
+        return;
+    }
+    band_sums.assign(static_cast<size_t>(n) * bands, 0);
+    pool->run(bands, [&](int b) {
+        const int r0 = b * Projection::BAND_ROWS;
+        column_sum(img.rowRange(r0, std::min(img.rows, r0 + Projection::BAND_ROWS)), band_sums.data() + static_cast<size_t>(b) * n);
+    });
+    for (int b = 0; b < bands; b++) {
+        const uint32_t* s = band_sums.data() + static_cast<size_t>(b) * n;
+        for (int i = 0; i < n; i++) {
+            col_sums[i] += s[i];
+        }
+    }
+}
+
+/** Добавляет к накапливаемым спектрам средние по столбцам значения
+ * @param sums суммы по столбцам кадра, по cn значений (каналов) на столбец
+ * @param cn раскладка пикселя: 1 - оттенки серого, 2 - YUYV (яркость в первом байте каждой пары),
+ *           3 - BGR, 4 - BGRA. Для BGR яркость вычисляется по весам cv::COLOR_BGR2GRAY.
+ * @param rows количество строк, по которым вычислены суммы
+ */
+void Model_Spectr::add_column_sums(const uint32_t* sums, int cn, int rows) {
+    const double k = 1.0 / rows;
+    double* base = spectr.ptr<double>(row_base);
+    if (cn >= 3) {
+        double* red = spectr.ptr<double>(row_red);
+        double* green = spectr.ptr<double>(row_green);
+        double* blue = spectr.ptr<double>(row_blue);
+        for (int i = 0; i < spectr.cols; i++) {
+            const uint32_t* p = sums + i * cn;
+            base[i] += (0.114 * p[0] + 0.587 * p[1] + 0.299 * p[2]) * k;
+            if (channels) {
+                blue[i] += p[0] * k;
+                green[i] += p[1] * k;
+                red[i] += p[2] * k;
+            }
+        }
     }
     else {
-        return data;
+        for (int i = 0; i < spectr.cols; i++) {
+            base[i] += sums[i * cn] * k;
+        }
     }
 }
 
+/** Включение расчета спектров по каналам цвета R, G, B */
+void Model_Spectr::set_channels(bool state) {
+    channels = state;
+}
+
+/** Включение коррекции спектра по темновому кадру и кадру плоского поля (get_correction()) */
+void Model_Spectr::set_correction(bool state) {
+    correct = state;
+}
+
+/** Включение поиска пиков в публикуемых спектрах (Snapshot::peaks), параметры - get_peak_tracker() */
+void Model_Spectr::set_peaks(bool state) {
+    find_peaks = state;
+}
+
+/** Установка библиотеки эталонов (nullptr - без сравнения)
+ *  Сетка библиотеки должна совпадать с set_uniform_grid(). Вызывается до начала обработки кадров.
+ * @param top_k количество лучших совпадений в снимке
+ */
+void Model_Spectr::set_library(std::shared_ptr<const SpectralLibrary> lib, int top_k) {
+    library = lib;
+    library_top = top_k;
+}
+
+/** Сохранить (запомнить) текущий (последний накопленный) спектр
+ *  Выполняется производителем при обработке следующего кадра.
+ */
+void Model_Spectr::spectr_memset() {
+    std::lock_guard<std::mutex> lock(cmd_mtx);
+    cmd_mem = mem_cmd::set;
+    cmd_pending = true;
+}
+
+/** Загрузка сохраненного спектра (например, среднего спектра из хранилища)
+ *  Выполняется производителем при обработке следующего кадра, если ширина спектра совпадает с текущей.
+ * @param values спектр в масштабе одного кадра
+ */
+void Model_Spectr::spectr_memload(const std::vector<double>& values) {
+    std::lock_guard<std::mutex> lock(cmd_mtx);
+    cmd_mem_values = values;
+    cmd_mem = mem_cmd::load;
+    cmd_pending = true;
+}
+
+/** Очистка сохраненного спектра */
+void Model_Spectr::spectr_memclear() {
+    std::lock_guard<std::mutex> lock(cmd_mtx);
+    cmd_mem = mem_cmd::clear;
+    cmd_pending = true;
+}
+
+/** Возвращает последний опубликованный снимок данных модели, закрепленный на время жизни ссылки
+    Матрица data_rows x (ширина окна). Строка row_std - разброс яркости между кадрами в масштабе row_base.
+    Строка row_mem действительна, если mem,
+    строки row_red, row_green, row_blue - если channels
+*/
+Model_Spectr::SnapshotRef Model_Spectr::snapshot() const {
+    return snapshots.read();
+}
+
 /** Калибровка шкалы X по точкам
     Точка (позиция пикселя, длинна волны)
-    Если в векторе 2 точки - то выполняется линейная интерполяция
-    Если в векторе 3 точки - то выполняется интерполяция полиномом 2ой степени
-    Если меньше одной точки, то y(x)=x; 
+    По N точкам строится полином степени order (но не больше N - 1) методом наименьших квадратов:
+    2 точки - линейная интерполяция, 3 точки при order = 2 - интерполяция полиномом 2ой степени.
+    Если точек меньше двух, то y(x)=x; 
+    Шкала пересчитывается производителем при обработке следующего кадра.
+ */
+void Model_Spectr::calibrate(const std::vector<std::pair<int, int>>& cpt, int order) {
+    std::lock_guard<std::mutex> lock(cmd_mtx);
+    cmd_calibr_pts = cpt;
+    cmd_calibr_order = order;
+    cmd_calibrate = true;
+    cmd_pending = true;
+}
+
+/** Задание равномерной сетки длин волн для передискретизации публикуемых спектров (Snapshot::uniform)
+ *  Вызывается до начала обработки кадров. step <= 0 - передискретизация не выполняется.
+ */
+void Model_Spectr::set_uniform_grid(double from, double to, double step) {
+    resampler.set_grid(from, to, step);
+    if (resampler.enabled()) {
+        log1 << "Uniform wavelength grid " << from << ".." << to << " nm, step " << step << " nm, "
+             << resampler.size() << " points" << std::endl;
+    }
+}
+
+/** Расчет шкалы X (строка row_nm) по точкам калибровки calibr_pts
+ *  и весов передискретизации на равномерную сетку
  */
-void Model_Spectr::calibrate(const std::vector<std::pair<int, int>>& cpt) {
-    calibr_pts = cpt;
+void Model_Spectr::apply_calibration() {
+    resampler.reset();
+    calib_version++;
     if (data.cols == 0)
         return;
 
-    if (cpt.size() == 2) {   // linear interpolation
-        double k = double(cpt[1].second - cpt[0].second) / (cpt[1].first - cpt[0].first);
-        double b = ((cpt[1].second + cpt[0].second) - k * (cpt[1].first + cpt[0].first)) * 0.5;
-        for (int i = 0; i < spectr.cols; i++) {
-            data.at<double>(row_nm, i) = k * i + b;
-        }
-    }
-    else if (cpt.size() >= 3) {   // 2nd inrerpolation
-        auto x1 = cpt[0].first;
-        auto x2 = cpt[1].first;
-        auto x3 = cpt[2].first;
-        auto y1 = cpt[0].second;
-        auto y2 = cpt[1].second;
-        auto y3 = cpt[2].second;
-        double a = double((y3 - y1) * (x2 - x1) - (y2 - y1) * (x3 - x1)) / ((x3 * x3 - x1 * x1) * (x2 - x1) - (x2 * x2 - x1 * x1) * (x3 - x1));
-        double b = (y2 - y1 - a * (x2 * x2 - x1 * x1)) / (x2 - x1);
-        double c = y1 - (a * x1 * x1 + b * x1);
-        for (int i = 0; i < spectr.cols; i++) {
-            data.at<double>(row_nm, i) = a * i * i + b * i + c;
+    if (calibration.fit(calibr_pts, calibr_order)) {
+        for (int i = 0; i < data.cols; i++) {
+            data.at<double>(row_nm, i) = calibration(i);
         }
+        resampler.build(data.ptr<double>(row_nm), data.cols);
     }
     else { // non calibrated scale
-        for (int i = 0; i < spectr.cols; i++) {
+        for (int i = 0; i < data.cols; i++) {
             data.at<double>(row_nm, i) = i;
         }
     }
 }
+
+
+/** Самопроверка скользящего окна на полной шкале 16-битного кадра с усилением плоского поля ~90
+ *  Спектр в режиме sliding по одинаковым кадрам должен совпадать со спектром одного кадра (режим block):
+ *  значения окна не переполняются и суммы не переходят через границу разрядной сетки.
+ */
+bool Model_Spectr::window_selftest() {
+    const cv::Size size(64, 8);
+    cv::Mat flat(size, CV_32F, cv::Scalar(10000));
+    flat.col(size.width / 2).setTo(110);  // чуть выше порога 0.01 среднего - наибольшее усиление
+    const cv::Mat frame(size, CV_16UC1, cv::Scalar(65535));
+    Model_Spectr sliding({}, 4), block({}, 1);
+    sliding.set_accumulation(accumulation::sliding);
+    for (Model_Spectr* m : { &sliding, &block }) {
+        m->get_correction().set_flat(flat);
+        m->set_correction(true);
+        for (int i = 0; i < 6; i++) {
+            m->udpate_data(frame);
+        }
+    }
+    auto a = sliding.snapshot();
+    auto b = block.snapshot();
+    if (!a || !b || a->data.cols != b->data.cols) {
+        return false;
+    }
+    const double* x = a->data.ptr<double>(row_base);
+    const double* y = b->data.ptr<double>(row_base);
+    for (int i = 0; i < a->data.cols; i++) {
+        if (std::abs(x[i] - y[i]) > 1e-3 * std::max(1.0, std::abs(y[i]))) {
+            return false;
+        }
+    }
+    return y[size.width / 2] > 65535.0 * 50;  // усиление действительно применено
+}
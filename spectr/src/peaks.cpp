@@ -0,0 +1,215 @@
+/**
+ * @file peaks.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация поиска и сопровождения пиков спектра
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "peaks.h"
+
+namespace {
+    // Изменение спектра в области пика меньше CHANGE_SIGMAS шумов считается несущественным
+    const double CHANGE_SIGMAS = 3.0;
+
+    /** Медиана первых n элементов буфера (порядок элементов меняется) */
+    double median(std::vector<double>& v, size_t n) {
+        auto mid = v.begin() + n / 2;
+        std::nth_element(v.begin(), mid, v.begin() + n);
+        return *mid;
+    }
+}
+
+/** Настройка поиска
+ * @param thr порог обнаружения в шумах над уровнем фона
+ * @param m способ уточнения вершины
+ * @param max_n максимальное количество пиков (остаются самые высокие)
+ */
+void PeakTracker::set_options(double thr, fit m, int max_n) {
+    threshold = thr;
+    method = m;
+    max_peaks = std::max(1, max_n);
+    reset();
+}
+
+/** Способ уточнения по названию: parabolic, gaussian, centroid (по умолчанию gaussian) */
+PeakTracker::fit PeakTracker::parse_fit(const std::string& name) {
+    if (name == "parabolic") {
+        return fit::parabolic;
+    }
+    if (name == "centroid") {
+        return fit::centroid;
+    }
+    return fit::gaussian;
+}
+
+/** Сброс сопровождения: следующее обновление находит все пики заново */
+void PeakTracker::reset() {
+    list.clear();
+    samples.clear();
+    width = 0;
+    refit_count = 0;
+}
+
+/** Оценка уровня фона (медиана) и шума (медиана абсолютных отклонений разностей соседних ячеек) */
+void PeakTracker::estimate_floor(const double* y, int n) {
+    scratch.assign(y, y + n);
+    base = median(scratch, n);
+    for (int i = 0; i + 1 < n; i++) {
+        scratch[i] = y[i + 1] - y[i];
+    }
+    const double md = median(scratch, n - 1);
+    for (int i = 0; i + 1 < n; i++) {
+        scratch[i] = std::abs(y[i + 1] - y[i] - md);
+    }
+    // Для нормального шума СКО разности соседних ячеек в sqrt(2) раз больше СКО ячейки
+    sigma = 1.4826 * median(scratch, n - 1) / std::sqrt(2.0);
+    sigma = std::max(sigma, 1e-9 * std::max(std::abs(base), 1.0));
+}
+
+/** Уточнение пика с вершиной в ячейке i: положение, высота, ширина и область пика */
+void PeakTracker::fit_peak(const double* y, int n, int i, Peak& p) const {
+    const double a = y[i - 1], b = y[i], c = y[i + 1];
+    double delta = 0;
+    double height = b;
+    if (method == fit::gaussian && a > base && b > base && c > base) {
+        const double la = std::log(a - base), lb = std::log(b - base), lc = std::log(c - base);
+        const double den = la - 2 * lb + lc;
+        if (den < 0) {
+            delta = std::clamp(0.5 * (la - lc) / den, -0.5, 0.5);
+            height = base + std::exp(lb - 0.25 * (la - lc) * delta);
+        }
+    }
+    else {
+        const double den = a - 2 * b + c;
+        if (den < 0) {
+            delta = std::clamp(0.5 * (a - c) / den, -0.5, 0.5);
+            height = b - 0.25 * (a - c) * delta;
+        }
+    }
+
+    // Границы на половине высоты над фоном с линейной интерполяцией
+    const double half = base + 0.5 * (height - base);
+    int l = i;
+    while (l > 0 && y[l - 1] > half) {
+        l--;
+    }
+    int r = i;
+    while (r < n - 1 && y[r + 1] > half) {
+        r++;
+    }
+    const double xl = l > 0 ? l - 1 + (half - y[l - 1]) / (y[l] - y[l - 1]) : 0.0;
+    const double xr = r < n - 1 ? r + (y[r] - half) / (y[r] - y[r + 1]) : n - 1.0;
+
+    p.top = i;
+    p.bin = i + delta;
+    if (method == fit::centroid) {
+        double sw = 0, sx = 0;
+        for (int j = l; j <= r; j++) {
+            sw += y[j] - half;
+            sx += (y[j] - half) * j;
+        }
+        if (sw > 0) {
+            p.bin = sx / sw;
+        }
+    }
+    p.height = height;
+    p.fwhm = xr - xl;
+    p.from = std::max(0, l - 1);
+    p.to = std::min(n - 1, r + 1);
+}
+
+/** Возвращает true, если спектр в области пика или фон изменились с момента уточнения пика больше уровня шума */
+bool PeakTracker::region_changed(const double* y, const Peak& p) const {
+    const double tol = CHANGE_SIGMAS * sigma;
+    if (std::abs(base - p.fit_base) > tol) {
+        return true;
+    }
+    const double* ref = samples.data() + p.fit_samples - p.from;
+    for (int j = p.from; j <= p.to; j++) {
+        if (std::abs(y[j] - ref[j]) > tol) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Обработка очередного спектра из n ячеек */
+void PeakTracker::update(const double* y, int n) {
+    refit_count = 0;
+    if (n < 3) {
+        reset();
+        return;
+    }
+    if (width != n) {
+        // Новая ширина спектра - прежние пики не сопоставимы
+        list.clear();
+        samples.clear();
+        width = n;
+    }
+    estimate_floor(y, n);
+
+    // Кандидаты - локальные максимумы выше порога, из близких остается больший
+    const double level = base + threshold * sigma;
+    candidates.clear();
+    for (int i = 1; i < n - 1; i++) {
+        if (y[i] > level && y[i] >= y[i - 1] && y[i] > y[i + 1]) {
+            if (!candidates.empty() && i - candidates.back() < MIN_DISTANCE) {
+                if (y[i] > y[candidates.back()]) {
+                    candidates.back() = i;
+                }
+            }
+            else {
+                candidates.push_back(i);
+            }
+        }
+    }
+    if (static_cast<int>(candidates.size()) > max_peaks) {
+        std::nth_element(candidates.begin(), candidates.begin() + max_peaks, candidates.end(),
+                         [y](int l, int r) { return y[l] > y[r]; });
+        candidates.resize(max_peaks);
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+    // Сопоставление с пиками предыдущего обновления
+    matched.assign(list.size(), 0);
+    next.clear();
+    next_samples.clear();
+    for (int i : candidates) {
+        int best = -1;
+        int best_d = MATCH_RADIUS + 1;
+        for (size_t k = 0; k < list.size(); k++) {
+            const int d = std::abs(list[k].top - i);
+            if (!matched[k] && d < best_d) {
+                best = static_cast<int>(k);
+                best_d = d;
+            }
+        }
+        Peak p;
+        if (best >= 0) {
+            matched[best] = 1;
+            p = list[best];
+            p.age++;
+            if (best_d == 0 && !region_changed(y, p)) {
+                const auto from = samples.begin() + p.fit_samples;
+                p.fit_samples = static_cast<int>(next_samples.size());
+                next_samples.insert(next_samples.end(), from, from + (p.to - p.from + 1));
+                next.push_back(p);
+                continue;
+            }
+        }
+        else {
+            p.id = next_id++;
+            p.age = 1;
+        }
+        fit_peak(y, n, i, p);
+        p.fit_base = base;
+        p.fit_samples = static_cast<int>(next_samples.size());
+        next_samples.insert(next_samples.end(), y + p.from, y + p.to + 1);
+        refit_count++;
+        next.push_back(p);
+    }
+    list.swap(next);
+    samples.swap(next_samples);
+}
@@ -0,0 +1,224 @@
+/**
+ * @file projection.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация проекции повернутого окна кадра на ось спектра
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "projection.h"
+
+/** Возвращает true, если таблицы проекции построены для данных параметров */
+bool Projection::matches(cv::Size fs, cv::Rect r, double a) const {
+    return !spans.empty() && fs == frame_size && r == roi && a == angle;
+}
+
+/** Построение таблиц проекции
+ * @param fs размер кадра
+ * @param r окно в кадре (до поворота)
+ * @param a угол поворота окна в градусах, положительный - против часовой стрелки (как cv::getRotationMatrix2D)
+ */
+void Projection::setup(cv::Size fs, cv::Rect r, double a) {
+    frame_size = fs;
+    roi = r;
+    angle = a;
+    spans.clear();
+    band_spans.clear();
+    norm.assign(roi.width, 0.0);
+    acc.assign(4 * (roi.width + 1), 0.0);
+    if (roi.width <= 0 || roi.height <= 0) {
+        return;
+    }
+
+    // Пиксель кадра (x, y) попадает в точку (u, v) повернутого окна:
+    // u = W/2 + cos*(x - cx) + sin*(y - cy), v = H/2 - sin*(x - cx) + cos*(y - cy)
+    const double ca = std::cos(angle * CV_PI / 180.0);
+    const double sa = std::sin(angle * CV_PI / 180.0);
+    CV_Assert(ca > 0);
+    const double cx = roi.x + roi.width / 2.0;
+    const double cy = roi.y + roi.height / 2.0;
+    const double u_max = roi.width - 1.0;
+    const double v_max = roi.height;
+    u_step = ca;
+
+    for (int y = 0; y < frame_size.height; y++) {
+        // u(x) = u0 + ca*x, v(x) = v0 - sa*x; ищем x, для которых 0 <= u <= u_max и 0 <= v < v_max
+        const double u0 = roi.width / 2.0 - ca * cx + sa * (y - cy);
+        const double v0 = roi.height / 2.0 + sa * cx + ca * (y - cy);
+        double lo = -u0 / ca;
+        double hi = (u_max - u0) / ca;
+        if (sa > 0) {
+            lo = std::max(lo, (v0 - v_max) / sa);
+            hi = std::min(hi, v0 / sa);
+        }
+        else if (sa < 0) {
+            lo = std::max(lo, v0 / sa);
+            hi = std::min(hi, (v0 - v_max) / sa);
+        }
+        else if (v0 < 0 || v0 >= v_max) {
+            continue;
+        }
+        int x_from = std::max(0, static_cast<int>(std::ceil(lo)));
+        int x_to = std::min(frame_size.width - 1, static_cast<int>(std::floor(hi)));
+        // Границы уточняются, чтобы округления не вывели пиксель за пределы окна
+        while (x_from <= x_to && (u0 + ca * x_from < 0 || v0 - sa * x_from < 0 || v0 - sa * x_from >= v_max)) {
+            x_from++;
+        }
+        while (x_to >= x_from && (u0 + ca * x_to > u_max || v0 - sa * x_to < 0 || v0 - sa * x_to >= v_max)) {
+            x_to--;
+        }
+        if (x_from > x_to) {
+            continue;
+        }
+        while (static_cast<int>(band_spans.size()) <= y / BAND_ROWS) {
+            band_spans.push_back(spans.size());
+        }
+        spans.push_back({ y, x_from, x_to, u0 + ca * x_from });
+    }
+    band_spans.push_back(spans.size());
+    acc.assign(4 * (roi.width + 1) * std::max<size_t>(1, band_spans.size() - 1), 0.0);
+
+    // Сумма весов по ячейкам - проекция кадра из единиц
+    for (const auto& s : spans) {
+        double u = s.u_from;
+        for (int x = s.x_from; x <= s.x_to; x++, u += u_step) {
+            const int i = std::min(static_cast<int>(u), roi.width - 1);
+            const double f = u - i;
+            acc[i] += 1.0 - f;
+            acc[i + 1] += f;
+        }
+    }
+    for (int i = 0; i < roi.width; i++) {
+        norm[i] = acc[i] > 0 ? 1.0 / acc[i] : 0.0;
+    }
+}
+
+/** Проекция строк кадра spans[span_from, span_to) на ось спектра (накопление в a без нормирования) */
+template <typename T, int CN, bool WITH_CHANNELS>
+void Projection::project_rows(const cv::Mat& frame, size_t span_from, size_t span_to, double* a) const {
+    const size_t stride = roi.width + 1;
+    for (size_t k = span_from; k < span_to; k++) {
+        const RowSpan& s = spans[k];
+        const T* p = frame.ptr<T>(s.y) + s.x_from * CN;
+        double u = s.u_from;
+        for (int x = s.x_from; x <= s.x_to; x++, u += u_step, p += CN) {
+            double g;
+            if constexpr (CN == 1) {
+                g = p[0];
+            }
+            else {
+                g = 0.114 * p[0] + 0.587 * p[1] + 0.299 * p[2];
+            }
+            const int i = std::min(static_cast<int>(u), roi.width - 1);
+            const double f = u - i;
+            a[i] += g - g * f;
+            a[i + 1] += g * f;
+            if constexpr (WITH_CHANNELS) {
+                for (int c = 0; c < 3; c++) {
+                    const double v = p[c];
+                    a[(c + 1) * stride + i] += v - v * f;
+                    a[(c + 1) * stride + i + 1] += v * f;
+                }
+            }
+        }
+    }
+}
+
+/** Проекция одной полосы кадра в буфер a */
+void Projection::project_band(const cv::Mat& frame, bool with_channels, int band, double* a) const {
+    const size_t from = band_spans[band], to = band_spans[band + 1];
+    switch (frame.type()) {
+    case CV_8UC1:
+        project_rows<uchar, 1, false>(frame, from, to, a);
+        break;
+    case CV_8UC3:
+        with_channels ? project_rows<uchar, 3, true>(frame, from, to, a) : project_rows<uchar, 3, false>(frame, from, to, a);
+        break;
+    case CV_16UC1:
+        project_rows<ushort, 1, false>(frame, from, to, a);
+        break;
+    case CV_16UC3:
+        with_channels ? project_rows<ushort, 3, true>(frame, from, to, a) : project_rows<ushort, 3, false>(frame, from, to, a);
+        break;
+    case CV_32FC1:
+        project_rows<float, 1, false>(frame, from, to, a);
+        break;
+    case CV_32FC3:
+        with_channels ? project_rows<float, 3, true>(frame, from, to, a) : project_rows<float, 3, false>(frame, from, to, a);
+        break;
+    default:
+        CV_Error(cv::Error::StsUnsupportedFormat, "Unsupported frame type for projection");
+    }
+}
+
+/** Добавляет к out среднюю яркость пикселей окна для каждой ячейки спектра
+ * @param frame кадр размера frame_size типа CV_8UC1, CV_8UC3, CV_16UC1, CV_16UC3, CV_32FC1 или CV_32FC3 (BGR)
+ * @param out массив из bins() элементов
+ * @param channels nullptr или три массива из bins() элементов для средних значений каналов B, G, R
+ *                 (только для трехканальных кадров)
+ * @param pool пул потоков для параллельной обработки полос или nullptr
+ */
+void Projection::project(const cv::Mat& frame, double* out, double* const* channels, WorkerPool* pool) const {
+    const Target t{ this, out, channels };
+    project_many(frame, &t, 1, pool);
+}
+
+/** Проекция нескольких окон одного кадра за один проход по кадру
+ *  Кадр обходится полосами по BAND_ROWS строк (при наличии пула - параллельно), в каждой полосе
+ *  проецируются все окна, которые ее пересекают. Результат каждого окна такой же, как у project().
+ * @param targets n окон, проекции которых построены для размера frame (setup)
+ */
+void Projection::project_many(const cv::Mat& frame, const Target* targets, size_t n, WorkerPool* pool) {
+    const bool color = frame.channels() == 3;
+    int bands = 0;
+    for (size_t k = 0; k < n; k++) {
+        const Projection* p = targets[k].projection;
+        CV_Assert(frame.size() == p->frame_size);
+        std::fill(p->acc.begin(), p->acc.end(), 0.0);
+        bands = std::max(bands, p->bands());
+    }
+    auto band = [&](int b) {
+        for (size_t k = 0; k < n; k++) {
+            const Projection* p = targets[k].projection;
+            if (b < p->bands()) {
+                p->project_band(frame, color && targets[k].channels != nullptr, b, p->acc.data() + b * 4 * (p->roi.width + 1));
+            }
+        }
+    };
+    if (pool != nullptr && bands > 1) {
+        pool->run(bands, band);
+    }
+    else {
+        for (int b = 0; b < bands; b++) {
+            band(b);
+        }
+    }
+    for (size_t k = 0; k < n; k++) {
+        const Projection* p = targets[k].projection;
+        if (p->bands() > 0) {
+            p->finish(targets[k].out, targets[k].channels, color && targets[k].channels != nullptr);
+        }
+    }
+}
+
+/** Объединение сумм полос в фиксированном порядке и нормирование результата */
+void Projection::finish(double* out, double* const* channels, bool with_channels) const {
+    const size_t stride = roi.width + 1;
+    for (int b = 1; b < bands(); b++) {
+        const double* a = acc.data() + b * 4 * stride;
+        for (size_t i = 0; i < 4 * stride; i++) {
+            acc[i] += a[i];
+        }
+    }
+
+    for (int i = 0; i < roi.width; i++) {
+        out[i] += acc[i] * norm[i];
+    }
+    if (with_channels) {
+        for (int c = 0; c < 3; c++) {
+            for (int i = 0; i < roi.width; i++) {
+                channels[c][i] += acc[(c + 1) * stride + i] * norm[i];
+            }
+        }
+    }
+}
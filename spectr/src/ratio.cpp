@@ -0,0 +1,42 @@
+/**
+ * @file ratio.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация расчета пропускания и оптической плотности
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "ratio.h"
+
+void spectr_ratio(const cv::Mat& base, double base_scale, const cv::Mat& ref, double ref_scale,
+                  ratio_mode mode, const RatioOptions& opt, cv::Mat& out) {
+    CV_Assert(base.type() == CV_64F && ref.type() == CV_64F && base.size() == ref.size());
+    out.create(base.size(), CV_64F);
+    if (mode == ratio_mode::off) {
+        base.copyTo(out);
+        return;
+    }
+    // Суммы нескольких кадров приводятся к масштабу одного кадра, чтобы темновой уровень и порог
+    // опорного сигнала не зависели от количества кадров накопления
+    const double kb = 1.0 / std::max(base_scale, 1.0);
+    const double kr = 1.0 / std::max(ref_scale, 1.0);
+    const double d = opt.dark_offset;
+    const double t_min = mode == ratio_mode::absorbance ? std::pow(10.0, -opt.a_max) : 0.0;
+    const double min_ref = std::max(opt.min_ref, 1e-12);
+    const int n = static_cast<int>(base.total());
+    const double* b = base.ptr<double>();
+    const double* r = ref.ptr<double>();
+    double* t = out.ptr<double>();
+    // Цикл без ветвлений, векторизуется компилятором
+    for (int i = 0; i < n; i++) {
+        const double num = b[i] * kb - d;
+        const double den = r[i] * kr - d;
+        const double v = num / std::max(den, min_ref);
+        t[i] = std::clamp(den >= min_ref ? v : t_min, t_min, opt.t_max);
+    }
+    if (mode == ratio_mode::absorbance) {
+        // Векторизованный логарифм OpenCV: A = -ln(T) / ln(10)
+        cv::log(out, out);
+        out.convertTo(out, CV_64F, -1.0 / std::log(10.0));
+    }
+}
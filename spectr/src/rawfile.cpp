@@ -0,0 +1,146 @@
+/**
+ * @file rawfile.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Запись кадров в файл *.sraw и отображение файла в память
+ */
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include "rawfile.h"
+#include "optlog.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_literals;
+
+/*---------------------- RawRecorder --------------------------------*/
+
+/** Открывает файл записи, при необходимости записывает заголовок файла
+ * @param path путь к файлу *.sraw
+ * @throw runtime_error
+ */
+RawRecorder::RawRecorder(const std::string& path) {
+    std::error_code ec;
+    bool new_file = !std::filesystem::exists(path, ec) || std::filesystem::file_size(path, ec) == 0;
+    file.open(path, std::ios::binary | std::ios::app);
+    if (!file) {
+        throw std::runtime_error("Can't open file for recording "s + path);
+    }
+    if (new_file) {
+        RawFileHeader h{};
+        std::memcpy(h.magic, RAW_FILE_MAGIC, sizeof(h.magic));
+        h.version = 1;
+        h.header_size = sizeof(RawFileHeader);
+        file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+}
+
+/** Дописывает кадр в файл
+ * @param frame кадр
+ * @param props параметры видеозахвата, действовавшие при получении кадра
+ */
+void RawRecorder::write(const cv::Mat& frame, const RawFrameProps& props) {
+    static const char zeros[RAW_ALIGN] = {};
+    const size_t row_bytes = frame.cols * frame.elemSize();
+    const size_t bytes = row_bytes * frame.rows;
+
+    RawFrameHeader h{};
+    h.magic = RAW_FRAME_MAGIC;
+    h.header_size = sizeof(RawFrameHeader);
+    h.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    h.rows = frame.rows;
+    h.cols = frame.cols;
+    h.type = frame.type();
+    h.step = static_cast<uint32_t>(row_bytes);
+    h.gain = props.gain;
+    h.exposure = props.exposure;
+    h.fourcc = props.fourcc;
+    h.data_size = (bytes + RAW_ALIGN - 1) / RAW_ALIGN * RAW_ALIGN;
+
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (frame.isContinuous()) {
+        file.write(reinterpret_cast<const char*>(frame.data), bytes);
+    }
+    else {
+        for (int r = 0; r < frame.rows; r++) {
+            file.write(reinterpret_cast<const char*>(frame.ptr(r)), row_bytes);
+        }
+    }
+    file.write(zeros, h.data_size - bytes);
+    if (!file) {
+        log0 << "Failed to write frame to record file" << std::endl;
+        return;
+    }
+    frames_written++;
+}
+
+
+/*---------------------- MappedFile --------------------------------*/
+
+/** Отображает файл в память
+ * @throw runtime_error
+ */
+MappedFile::MappedFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE hfile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hfile == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Can't open file "s + path);
+    }
+    file_handle = hfile;
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(hfile, &sz) || sz.QuadPart == 0) {
+        CloseHandle(hfile);
+        throw std::runtime_error("Empty or unreadable file "s + path);
+    }
+    length = static_cast<size_t>(sz.QuadPart);
+    map_handle = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_handle != nullptr) {
+        ptr = static_cast<uint8_t*>(MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (ptr == nullptr) {
+        if (map_handle != nullptr) {
+            CloseHandle(map_handle);
+        }
+        CloseHandle(hfile);
+        throw std::runtime_error("Can't map file "s + path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Can't open file "s + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Empty or unreadable file "s + path);
+    }
+    length = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Can't map file "s + path);
+    }
+    ptr = static_cast<uint8_t*>(p);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    UnmapViewOfFile(ptr);
+    CloseHandle(map_handle);
+    CloseHandle(file_handle);
+#else
+    munmap(ptr, length);
+#endif
+}
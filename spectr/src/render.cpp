@@ -0,0 +1,74 @@
+/**
+ * @file render.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация цикла отрисовки
+ */
+
+#include <algorithm>
+#include "render.h"
+#include "view.h"
+
+/** Конструктор
+ * @param fps частота отрисовки, Гц
+ */
+RenderLoop::RenderLoop(double fps)
+    : period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(fps, 1.0)))),
+      next_tick(std::chrono::steady_clock::now()) {
+}
+
+/** Отрисовка вида по обновлениям модели. Модель должна быть подписана на этот объект (m.subscribe).
+ *  Вызывается до запуска обработки кадров.
+ */
+void RenderLoop::attach(Model& m, std::shared_ptr<View> view) {
+    auto e = std::make_unique<Entry>();
+    e->model = &m;
+    e->view = view;
+    entries.push_back(std::move(e));
+}
+
+/** Уведомление модели (поток обработки): только отметка об обновлении */
+void RenderLoop::on_data_updated(Model& m) {
+    updates.fetch_add(1, std::memory_order_relaxed);
+    for (auto& e : entries) {
+        if (e->model == &m) {
+            e->published.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
+
+/** Такт отрисовки (поток интерфейса): отрисовка активных видов обновившихся моделей, затем refresh() активных видов */
+void RenderLoop::tick() {
+    next_tick = std::max(next_tick + period, std::chrono::steady_clock::now());
+    for (auto& e : entries) {
+        const uint64_t published = e->published.load(std::memory_order_acquire);
+        if (published == e->seen) {
+            continue;
+        }
+        if (e->view->active()) {
+            const uint64_t lost = published - e->seen - 1;
+            e->rendered++;
+            e->skipped += lost;
+            rendered++;
+            skipped += lost;
+            e->view->set_render_stat(e->rendered, e->skipped);
+            e->view->on_data_updated(*e->model);
+        }
+        e->seen = published;
+    }
+    for (auto& e : entries) {
+        if (e->view->active()) {
+            e->view->refresh();
+        }
+    }
+}
+
+/** Время до следующего такта, мс (не меньше 1 - для обработки событий окна в cv::waitKey) */
+int RenderLoop::wait_ms() const {
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - std::chrono::steady_clock::now());
+    return std::max(1, static_cast<int>(left.count()));
+}
+
+/** Счетчики отрисовки (вызывается из потока интерфейса) */
+RenderLoop::Stat RenderLoop::stat() const {
+    return { updates.load(std::memory_order_relaxed), rendered, skipped };
+}
@@ -0,0 +1,58 @@
+/**
+ * @file sink.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация вывода спектров в файл или поток
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include "sink.h"
+#include "format.h"
+
+/** Конструктор
+ * @param path файл csv ("-" - стандартный вывод)
+ * @param std_out поток стандартного вывода для path "-"
+ */
+SpectrCsvSink::SpectrCsvSink(const std::string& path, std::ostream& std_out) : out(&std_out) {
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            throw std::runtime_error("Can't open output file " + path);
+        }
+        out = &file;
+    }
+}
+
+/** Запись последнего опубликованного снимка (повторно один снимок не записывается) */
+void SpectrCsvSink::on_data_updated(Model& m) {
+    auto snapshot = dynamic_cast<Model_Spectr&>(m).snapshot();
+    if (!snapshot || snapshot->version == last_version) {
+        return;
+    }
+    last_version = snapshot->version;
+    const cv::Mat& data = snapshot->data;
+    line.clear();
+    auto it = std::back_inserter(line);
+    const double* nm = data.ptr<double>(Model_Spectr::row_nm);
+    if (static_cast<int>(header_nm.size()) != data.cols || !std::equal(nm, nm + data.cols, header_nm.begin())) {
+        header_nm.assign(nm, nm + data.cols);
+        fmt::format_to(it, "time_us;frames");
+        for (int i = 0; i < data.cols; i++) {
+            fmt::format_to(it, ";{:.2f}", nm[i]);
+        }
+        line += '\n';
+    }
+    const auto t = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const double k = 1.0 / std::max(snapshot->scale, 1.0);
+    fmt::format_to(it, "{};{}", t, snapshot->scale);
+    const double* y = data.ptr<double>(Model_Spectr::row_base);
+    for (int i = 0; i < data.cols; i++) {
+        fmt::format_to(it, ";{:.2f}", y[i] * k);
+    }
+    line += '\n';
+    out->write(line.data(), static_cast<std::streamsize>(line.size()));
+    count++;
+}
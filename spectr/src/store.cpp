@@ -0,0 +1,413 @@
+/**
+ * @file store.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация хранилища спектров *.sspec
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include "store.h"
+#include "format.h"
+#include "optlog.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_literals;
+
+namespace {
+    /** Размер записи с n значениями вместе с выравниванием */
+    uint64_t record_size(uint32_t n) {
+        return sizeof(StoreRecordHeader) + (uint64_t(n) * sizeof(float) + STORE_ALIGN - 1) / STORE_ALIGN * STORE_ALIGN;
+    }
+}
+
+/*---------------------- SpectrStore --------------------------------*/
+
+/** Открывает (создает) хранилище для записи
+ * @param path путь к файлу *.sspec
+ * @param chunk_bytes шаг увеличения файла
+ * @param index_step спектров между записями разреженного индекса (для нового файла)
+ * @throw runtime_error
+ */
+SpectrStore::SpectrStore(const std::string& path, size_t chunk_bytes, int index_step)
+    : file_path(path), chunk(round_up(std::max<size_t>(chunk_bytes, 1 << 20), 1 << 16)) {
+    std::error_code ec;
+    const auto size = std::filesystem::exists(path, ec) ? static_cast<size_t>(std::filesystem::file_size(path, ec)) : 0;
+    const bool new_file = size == 0;
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Can't open spectrum store "s + path);
+    }
+    file_handle = h;
+#else
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Can't open spectrum store "s + path);
+    }
+#endif
+    try {
+        map(round_up(size + 1, chunk));
+        StoreFileHeader* h = header();
+        if (new_file) {
+            std::memcpy(h->magic, STORE_FILE_MAGIC, sizeof(h->magic));
+            h->version = 1;
+            h->header_size = sizeof(StoreFileHeader);
+            h->data_end = sizeof(StoreFileHeader);
+            h->index_step = static_cast<uint32_t>(std::max(1, index_step));
+        }
+        else if (size < sizeof(StoreFileHeader) || std::memcmp(h->magic, STORE_FILE_MAGIC, sizeof(h->magic)) != 0 ||
+                 h->header_size != sizeof(StoreFileHeader) || h->data_end < h->header_size || h->data_end > size) {
+            throw std::runtime_error("Not a spectrum store file "s + path);
+        }
+    }
+    catch (...) {
+        unmap();
+        close();
+        throw;
+    }
+    this->index_step = std::max(1u, header()->index_step);
+    calib_id = header()->calibrations;
+    index.open(path + ".idx", std::ios::binary | (new_file ? std::ios::trunc : std::ios::app));
+    if (!index) {
+        log0 << "Can't open spectrum store index " << path << ".idx" << std::endl;
+    }
+    log1 << "Spectrum store " << path << ": " << header()->spectra << " spectra" << std::endl;
+}
+
+SpectrStore::~SpectrStore() {
+    close();
+}
+
+/** Отображение первых size байт файла (файл увеличивается до size) */
+void SpectrStore::map(size_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER li;
+    li.QuadPart = static_cast<LONGLONG>(size);
+    map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, static_cast<DWORD>(li.HighPart), li.LowPart, NULL);
+    if (map_handle != nullptr) {
+        ptr = static_cast<uint8_t*>(MapViewOfFile(map_handle, FILE_MAP_WRITE, 0, 0, size));
+    }
+    if (ptr == nullptr) {
+        if (map_handle != nullptr) {
+            CloseHandle(map_handle);
+            map_handle = nullptr;
+        }
+        throw std::runtime_error("Can't map spectrum store "s + file_path);
+    }
+#else
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        throw std::runtime_error("Can't extend spectrum store "s + file_path);
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Can't map spectrum store "s + file_path);
+    }
+    ptr = static_cast<uint8_t*>(p);
+#endif
+    mapped = size;
+}
+
+void SpectrStore::unmap() {
+    if (ptr == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(ptr);
+    CloseHandle(map_handle);
+    map_handle = nullptr;
+#else
+    munmap(ptr, mapped);
+#endif
+    ptr = nullptr;
+    mapped = 0;
+}
+
+/** Закрытие файла с усечением до конца данных (запас, выделенный под запись, освобождается) */
+void SpectrStore::close() {
+    const uint64_t end = ptr != nullptr ? header()->data_end : 0;
+    unmap();
+#ifdef _WIN32
+    if (file_handle != nullptr) {
+        if (end > 0) {
+            LARGE_INTEGER li;
+            li.QuadPart = static_cast<LONGLONG>(end);
+            // Если файл открыт читателем, усечение не выполняется - на данные это не влияет
+            if (!SetFilePointerEx(file_handle, li, NULL, FILE_BEGIN) || !SetEndOfFile(file_handle)) {
+                log1 << "Spectrum store " << file_path << " is not truncated" << std::endl;
+            }
+        }
+        CloseHandle(file_handle);
+        file_handle = nullptr;
+    }
+#else
+    if (fd >= 0) {
+        if (end > 0 && ftruncate(fd, static_cast<off_t>(end)) != 0) {
+            log1 << "Spectrum store " << file_path << " is not truncated" << std::endl;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+/** Дописывает запись в конец данных, при необходимости увеличивая файл
+ * @param v значения записи (n значений), сохраняются умноженными на k
+ * @return смещение записи
+ * @throw runtime_error, если файл не удалось увеличить
+ */
+uint64_t SpectrStore::write_record(uint32_t magic, const double* v, int n, double k, int64_t t, uint64_t calib_off,
+                                   uint32_t id, float frames) {
+    const uint64_t bytes = record_size(n);
+    const uint64_t offset = header()->data_end;
+    if (offset + bytes > mapped) {
+        unmap();
+        map(round_up(offset + bytes, chunk));
+    }
+    uint8_t* p = ptr + offset;
+    StoreRecordHeader h{ magic, static_cast<uint32_t>(n), t, magic == STORE_CALIB_MAGIC ? offset : calib_off, id, frames };
+    std::memcpy(p, &h, sizeof(h));
+    float* dst = reinterpret_cast<float*>(p + sizeof(h));
+    for (int i = 0; i < n; i++) {
+        dst[i] = static_cast<float>(v[i] * k);
+    }
+    std::memset(dst + n, 0, bytes - sizeof(h) - n * sizeof(float));
+    // Конец данных сдвигается только после записи всей записи
+    std::atomic_thread_fence(std::memory_order_release);
+    header()->data_end = offset + bytes;
+    return offset;
+}
+
+/** Добавление спектра (только производитель)
+ * @param nm шкала длин волн (n значений), записывается при смене калибровки или ширины спектра
+ * @param y спектр из n ячеек, сумма frames кадров
+ * @param calib_version версия калибровки модели (меняется при каждой калибровке)
+ */
+void SpectrStore::append(const double* nm, const double* y, int n, double frames, uint64_t calib_version) {
+    if (ptr == nullptr || n <= 0) {
+        return;
+    }
+    const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t t = std::max(now, header()->last_time_us);
+    try {
+        if (calib_version != calib_seen || n != calib_width) {
+            calib_offset = write_record(STORE_CALIB_MAGIC, nm, n, 1.0, t, 0, calib_id + 1, 0.F);
+            header()->calibrations = ++calib_id;
+            calib_seen = calib_version;
+            calib_width = n;
+        }
+        const uint64_t offset = write_record(STORE_SPECTR_MAGIC, y, n, 1.0 / std::max(frames, 1.0), t, calib_offset,
+                                             calib_id, static_cast<float>(frames));
+        const uint64_t k = header()->spectra++;
+        header()->last_time_us = t;
+        if (k % index_step == 0 && index) {
+            const StoreIndexEntry e{ t, offset };
+            index.write(reinterpret_cast<const char*>(&e), sizeof(e));
+            index.flush();
+        }
+    }
+    catch (const std::exception& e) {
+        // Запись прекращается, уже записанные данные сохраняются
+        log0 << e.what() << ", spectrum recording stopped" << std::endl;
+        unmap();
+    }
+}
+
+
+/*---------------------- SpectrStoreReader --------------------------------*/
+
+/** Открывает хранилище для чтения и строит разреженный индекс
+ *  Индекс читается из файла .idx; спектры после последней его записи (или все, если индекса нет)
+ *  просматриваются и индексируются в памяти.
+ * @throw runtime_error
+ */
+SpectrStoreReader::SpectrStoreReader(const std::string& path) : file(path) {
+    const auto* h = reinterpret_cast<const StoreFileHeader*>(file.data());
+    if (file.size() < sizeof(StoreFileHeader) || std::memcmp(h->magic, STORE_FILE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->header_size < sizeof(StoreFileHeader)) {
+        throw std::runtime_error("Not a spectrum store file "s + path);
+    }
+    data_begin = h->header_size;
+    data_end = std::min<uint64_t>(h->data_end, file.size());
+    spectra = h->spectra;
+    const uint32_t step = std::max(1u, h->index_step);
+
+    std::ifstream f(path + ".idx", std::ios::binary);
+    StoreIndexEntry e;
+    while (f.read(reinterpret_cast<char*>(&e), sizeof(e))) {
+        const auto* r = record(e.offset);
+        const bool valid = r != nullptr && r->magic == STORE_SPECTR_MAGIC && r->time_us == e.time_us &&
+                           (entries.empty() || (e.offset > entries.back().offset && e.time_us >= entries.back().time_us));
+        if (!valid) {
+            break;
+        }
+        entries.push_back(e);
+    }
+
+    // Хвост после последней записи индекса
+    bool indexed = !entries.empty();  // первый спектр хвоста уже в индексе
+    uint32_t since = 0;
+    for (uint64_t pos = indexed ? entries.back().offset : data_begin; pos < data_end; pos = next(pos)) {
+        const auto* r = record(pos);
+        if (r == nullptr) {
+            break;
+        }
+        if (r->magic != STORE_SPECTR_MAGIC) {
+            continue;
+        }
+        t_last = r->time_us;
+        if (!indexed && (entries.empty() || since >= step)) {
+            entries.push_back({ r->time_us, pos });
+            since = 0;
+        }
+        indexed = false;
+        since++;
+    }
+    t_first = entries.empty() ? 0 : entries.front().time_us;
+    log1 << "Spectrum store " << path << ": " << spectra << " spectra, " << entries.size() << " index entries" << std::endl;
+}
+
+/** Заголовок записи по смещению или nullptr, если по смещению нет целой записи */
+const StoreRecordHeader* SpectrStoreReader::record(uint64_t offset) const {
+    if (offset < data_begin || offset + sizeof(StoreRecordHeader) > data_end) {
+        return nullptr;
+    }
+    const auto* r = reinterpret_cast<const StoreRecordHeader*>(file.data() + offset);
+    if ((r->magic != STORE_SPECTR_MAGIC && r->magic != STORE_CALIB_MAGIC) || offset + record_size(r->width) > data_end) {
+        return nullptr;
+    }
+    return r;
+}
+
+/** Смещение записи, следующей за записью offset (data_end, если записей больше нет) */
+uint64_t SpectrStoreReader::next(uint64_t offset) const {
+    const auto* r = record(offset);
+    return r != nullptr ? offset + record_size(r->width) : data_end;
+}
+
+/** Смещение первого спектра со временем не раньше time_us (data_end, если таких нет)
+ *  Двоичный поиск по разреженному индексу, затем просмотр не более index_step спектров.
+ */
+uint64_t SpectrStoreReader::seek(int64_t time_us) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), time_us,
+                               [](const StoreIndexEntry& e, int64_t t) { return e.time_us < t; });
+    for (uint64_t pos = it == entries.begin() ? data_begin : std::prev(it)->offset; pos < data_end; pos = next(pos)) {
+        const auto* r = record(pos);
+        if (r == nullptr) {
+            break;
+        }
+        if (r->magic == STORE_SPECTR_MAGIC && r->time_us >= time_us) {
+            return pos;
+        }
+    }
+    return data_end;
+}
+
+/** Перебор спектров со временем от from_us до to_us включительно
+ * @param fn обработчик спектра; возвращает false, чтобы прекратить перебор
+ * @return количество переданных обработчику спектров
+ */
+size_t SpectrStoreReader::for_each(int64_t from_us, int64_t to_us, const std::function<bool(const Record&)>& fn) const {
+    size_t n = 0;
+    for (uint64_t pos = seek(from_us); pos < data_end; pos = next(pos)) {
+        const auto* r = record(pos);
+        if (r == nullptr || (r->magic == STORE_SPECTR_MAGIC && r->time_us > to_us)) {
+            break;
+        }
+        if (r->magic != STORE_SPECTR_MAGIC) {
+            continue;
+        }
+        const auto* c = record(r->calib_offset);
+        const bool have_nm = c != nullptr && c->magic == STORE_CALIB_MAGIC && c->width == r->width;
+        const Record rec{ r->time_us, r->calib_id, static_cast<int>(r->width), r->frames,
+                          reinterpret_cast<const float*>(r + 1),
+                          have_nm ? reinterpret_cast<const float*>(c + 1) : nullptr };
+        n++;
+        if (!fn(rec)) {
+            break;
+        }
+    }
+    return n;
+}
+
+/** Средний спектр за интервал времени (в масштабе одного кадра)
+ *  Усредняются спектры с той же шкалой длин волн, что и первый спектр интервала.
+ * @param nm шкала длин волн
+ * @return false, если в интервале нет спектров
+ */
+bool SpectrStoreReader::average(int64_t from_us, int64_t to_us, std::vector<double>& nm, std::vector<double>& mean) const {
+    uint32_t calib = 0;
+    size_t count = 0;
+    for_each(from_us, to_us, [&](const Record& r) {
+        if (count == 0) {
+            calib = r.calib_id;
+            mean.assign(r.width, 0.0);
+            if (r.nm != nullptr) {
+                nm.assign(r.nm, r.nm + r.width);
+            }
+            else {
+                nm.resize(r.width);
+                for (int i = 0; i < r.width; i++) {
+                    nm[i] = i;
+                }
+            }
+        }
+        if (r.calib_id == calib && r.width == static_cast<int>(mean.size())) {
+            for (int i = 0; i < r.width; i++) {
+                mean[i] += r.values[i];
+            }
+            count++;
+        }
+        return true;
+    });
+    if (count == 0) {
+        return false;
+    }
+    for (auto& v : mean) {
+        v /= static_cast<double>(count);
+    }
+    return true;
+}
+
+/** Экспорт спектров интервала времени в файл csv (разделитель ';')
+ *  Строка - спектр: время (с от начала эпохи) и значения. Перед первым спектром и при каждой смене
+ *  калибровки выводится строка заголовка со шкалой длин волн.
+ * @return количество записанных спектров
+ */
+size_t SpectrStoreReader::write_csv(const std::filesystem::path& path, int64_t from_us, int64_t to_us) const {
+    std::ofstream f(path);
+    std::string line;  // буфер строки используется повторно
+    uint32_t calib = 0;
+    return for_each(from_us, to_us, [&](const Record& r) {
+        line.clear();
+        if (r.calib_id != calib) {
+            calib = r.calib_id;
+            line += "time,s";
+            for (int i = 0; i < r.width; i++) {
+                fmt::format_to(std::back_inserter(line), ";{:.2f}", r.nm != nullptr ? r.nm[i] : float(i));
+            }
+            line += '\n';
+        }
+        fmt::format_to(std::back_inserter(line), "{:.3f}", r.time_us * 1e-6);
+        for (int i = 0; i < r.width; i++) {
+            fmt::format_to(std::back_inserter(line), ";{:.2f}", r.values[i]);
+        }
+        line += '\n';
+        f.write(line.data(), line.size());
+        return bool(f);
+    });
+}
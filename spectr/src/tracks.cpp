@@ -0,0 +1,194 @@
+/**
+ * @file tracks.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация обработки нескольких треков за один проход по кадру
+ */
+
+#include <algorithm>
+#include "tracks.h"
+#include "colsum.h"
+#include "helpers.h"
+#include "optlog.h"
+
+/** Создание набора треков
+ * @param main основной трек (модель, управляемая из интерфейса)
+ * @param fs открытый FileStorage с конфигурацией. Дополнительные треки задаются списком tracks:
+ *        NAME, X, Y, WIDTH, HEIGHT (окно в кадре), MODE (block, sliding, ema), ACC_FRAMES,
+ *        CALIB - точки калибровки [пиксель1, нм1, пиксель2, нм2, ...], CALIB_ORDER - степень полинома калибровки
+ * @param accumulate_frames количество кадров накопления по умолчанию
+ */
+TrackSet::TrackSet(Model_Spectr& main, cv::FileStorage& fs, long accumulate_frames) : main(main) {
+    cv::FileNode list = fs["tracks"];
+    if (!list.isSeq()) {
+        return;
+    }
+    for (const auto& node : list) {
+        Track t;
+        t.name = load_or_default(node, "NAME", std::string("track") + std::to_string(extra_tracks.size() + 2));
+        t.roi = cv::Rect(load_or_default(node, "X", 0), load_or_default(node, "Y", 0),
+                         load_or_default(node, "WIDTH", 0), load_or_default(node, "HEIGHT", 0));
+        if (t.roi.width <= 0 || t.roi.height <= 0) {
+            log0 << "Track " << t.name << ": WIDTH and HEIGHT must be positive, track is skipped" << std::endl;
+            continue;
+        }
+        std::vector<std::pair<int, int>> cpt;
+        cv::FileNode calib = node["CALIB"];
+        for (size_t i = 0; calib.isSeq() && i + 1 < calib.size(); i += 2) {
+            cpt.emplace_back(static_cast<int>(calib[static_cast<int>(i)]), static_cast<int>(calib[static_cast<int>(i + 1)]));
+        }
+        auto model = std::make_unique<Model_Spectr>(cpt, load_or_default(node, "ACC_FRAMES", static_cast<int>(accumulate_frames)));
+        const std::string mode = load_or_default(node, "MODE", std::string("block"));
+        model->calibrate(cpt, load_or_default(node, "CALIB_ORDER", 2));
+        model->set_accumulation(mode == "sliding" ? Model_Spectr::accumulation::sliding :
+                                mode == "ema" ? Model_Spectr::accumulation::ema : Model_Spectr::accumulation::block);
+        t.model = model.get();
+        owned.push_back(std::move(model));
+        extra_tracks.push_back(t);
+        log1 << "Track " << t.name << " roi=" << t.roi << " mode=" << mode << std::endl;
+    }
+}
+
+/** Установка общего пула потоков для всех треков */
+void TrackSet::set_pool(std::shared_ptr<WorkerPool> p) {
+    pool = p;
+    for (auto m : models()) {
+        m->set_pool(p);
+    }
+}
+
+/** Все модели треков: дополнительные, затем основная */
+std::vector<Model_Spectr*> TrackSet::models() const {
+    std::vector<Model_Spectr*> m;
+    for (const auto& t : extra_tracks) {
+        m.push_back(t.model);
+    }
+    m.push_back(&main);
+    return m;
+}
+
+/** Проверка окна трека в кадре размера frame_size
+ * @param outside состояние трека: окно вне кадра (сообщение в журнал выводится только при его смене)
+ * @return true, если окно пересекается с кадром и трек обрабатывается
+ */
+bool TrackSet::check_roi(const Model_Spectr& m, const std::string& name, cv::Size frame_size, bool& outside) {
+    const bool out = m.frame_rect(frame_size).empty();
+    if (out && !outside) {
+        log0 << "Track " << name << ": window is outside the " << frame_size << " frame, track is skipped" << std::endl;
+    }
+    else if (!out && outside) {
+        log0 << "Track " << name << ": window is inside the frame again" << std::endl;
+    }
+    outside = out;
+    return !out;
+}
+
+/** Обработка кадра всеми треками
+ *  Основной трек обрабатывается последним, чтобы при его уведомлении подписчиков
+ *  данные дополнительных треков уже были опубликованы.
+ */
+void TrackSet::udpate_data(const cv::Mat& frame) {
+    static const int PARALLEL_MIN_PIXELS = 256 * 1024;
+    const int cn = frame.channels();
+    const int angle = main.get_angle();
+    for (auto& t : extra_tracks) {
+        t.model->set_geometry(t.roi, angle);
+        check_roi(*t.model, t.name, frame.size(), t.outside);
+    }
+    check_roi(main, "main", frame.size(), main_outside);
+
+    // Окна без поворота
+    straight.clear();
+    size_t total = 0;
+    int y0 = frame.rows, y1 = 0;
+    int64_t area = 0;
+    auto add_straight = [&](Model_Spectr* m) {
+        if (m->get_angle() == 0) {
+            const cv::Rect r = m->frame_rect(frame.size());
+            straight.push_back({ m, r, total });
+            total += static_cast<size_t>(r.width) * cn;
+            y0 = std::min(y0, r.y);
+            y1 = std::max(y1, r.y + r.height);
+            area += r.area();
+        }
+    };
+    for (const auto& t : extra_tracks) {
+        if (!t.outside) {
+            add_straight(t.model);
+        }
+    }
+    if (!main_outside) {
+        add_straight(&main);
+    }
+
+    // Окна с поворотом (угол общий для всех треков) проецируются за один проход по кадру
+    targets.clear();
+    auto add_rotated = [&](Model_Spectr* m) {
+        if (m->get_angle() != 0) {
+            targets.push_back(m->begin_projected(frame.size()));
+        }
+    };
+    for (const auto& t : extra_tracks) {
+        if (!t.outside) {
+            add_rotated(t.model);
+        }
+    }
+    if (!main_outside) {
+        add_rotated(&main);
+    }
+    if (!targets.empty()) {
+        Projection::project_many(frame, targets.data(), targets.size(), pool.get());
+    }
+
+    // Один проход по кадру полосами: в каждой полосе суммируются все окна, которые ее пересекают
+    sums.assign(total, 0);
+    if (!straight.empty()) {
+        const int band0 = y0 / Projection::BAND_ROWS;
+        const int bands = (y1 - 1) / Projection::BAND_ROWS - band0 + 1;
+        auto reduce_band = [&](int b, uint32_t* out) {
+            const int by0 = (band0 + b) * Projection::BAND_ROWS;
+            const int by1 = by0 + Projection::BAND_ROWS;
+            for (const auto& s : straight) {
+                const int ry0 = std::max(s.rect.y, by0);
+                const int ry1 = std::min(s.rect.y + s.rect.height, by1);
+                if (ry0 < ry1) {
+                    column_sum(frame(cv::Range(ry0, ry1), cv::Range(s.rect.x, s.rect.x + s.rect.width)), out + s.offset);
+                }
+            }
+        };
+        if (pool && pool->size() > 1 && bands > 1 && area >= PARALLEL_MIN_PIXELS) {
+            band_sums.assign(total * bands, 0);
+            pool->run(bands, [&](int b) { reduce_band(b, band_sums.data() + total * b); });
+            for (int b = 0; b < bands; b++) {
+                const uint32_t* p = band_sums.data() + total * b;
+                for (size_t i = 0; i < total; i++) {
+                    sums[i] += p[i];
+                }
+            }
+        }
+        else {
+            for (int b = 0; b < bands; b++) {
+                reduce_band(b, sums.data());
+            }
+        }
+    }
+
+    // Накопление и публикация по трекам в порядке models()
+    size_t k = 0;
+    auto process = [&](Model_Spectr* m) {
+        if (k < straight.size() && straight[k].model == m) {
+            const auto& s = straight[k++];
+            m->udpate_sums(sums.data() + s.offset, frame.size(), cn, s.rect);
+        }
+        else {
+            m->udpate_projected(frame.size(), cn);
+        }
+    };
+    for (const auto& t : extra_tracks) {
+        if (!t.outside) {
+            process(t.model);
+        }
+    }
+    if (!main_outside) {
+        process(&main);
+    }
+}
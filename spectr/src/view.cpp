@@ -3,41 +3,129 @@
  * @author Sergey Simonov (sb.simonov@gmail.com)
  */
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <string>
+#include <iterator>
 #include "view.h"
 #include "format.h"
 #include "fps.h"
 #include "optlog.h"
 
+
+/** Частоты и счетчики для строки состояния: частота обработки кадров (из снимка модели), частота отрисовки,
+ *  отрисованные и пропущенные обновления модели (пропускаются при обработке быстрее отрисовки)
+ */
+void View::append_render_stat(std::string& s, double processing_fps) {
+    fmt::format_to(std::back_inserter(s), "FPS: {:.1f} | Display: {:.1f} fps, rendered {}, skipped {}",
+                   processing_fps, fps.fps(), rendered, skipped);
+}
+
 /*---------------------------- VideoView -------------------------------------*/
 
 /** Конструктор
  * @param w - Объект окна, на котором работает вид 
+ * @param width, height - наибольший размер показываемого кадра (больший кадр уменьшается)
  */
-VideoView::VideoView(Window& w) : View(w) {
+VideoView::VideoView(Window& w, int width, int height) : View(w), width(width), height(height) {
+    worker = std::thread(&VideoView::preview_loop, this);
+}
+
+VideoView::~VideoView() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv_pending.notify_one();
+    worker.join();
 }
 
-/** Отбражение видеокадра, поступившего от модели*/
+/** Передача рабочему потоку последнего снимка модели */
 void VideoView::on_data_updated(Model& m) {
-    auto& frame = m.get_data();
-    if (frame.empty()) {
+    auto snapshot = dynamic_cast<Model_Video&>(m).snapshot();
+    if (!snapshot) {
         return;
     }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        pending = std::move(snapshot);
+    }
+    cv_pending.notify_one();
+};
 
-    if (add_grid) {
-        const int n = 4; 
-        for (int i = 1; i < n; i ++) {
-            cv::line(frame, cv::Point(0, frame.rows * i/n), cv::Point(frame.cols - 1, frame.rows * i/n),
-                cv::Scalar(0, 100, 200), 1, cv::LineTypes::LINE_4);
-            cv::line(frame, cv::Point(frame.cols * i/n, 0), cv::Point(frame.cols * i/n, frame.rows),
-                cv::Scalar(0, 100, 200), 1, cv::LineTypes::LINE_4);
+/** Отображение готового превью */
+void VideoView::refresh() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!ready) {
+            return;
         }
+        std::swap(done, shown);
+        shown_frame = done_frame;
+        shown_fps = done_fps;
+        ready = false;
     }
     fps.tick();
-    window.draw(frame);
-    std::string str = fmt::format("Frame size: {}x{} \t | FPS: {:.1f}", frame.cols, frame.rows, fps.fps());
-    cv::displayStatusBar(window.name(), str, 0);
-};
+    window.draw(shown);
+    status.clear();
+    fmt::format_to(std::back_inserter(status), "Frame size: {}x{} \t | ", shown_frame.width, shown_frame.height);
+    append_render_stat(status, shown_fps);
+    cv::displayStatusBar(window.name(), status, 0);
+}
+
+/** Рабочий поток: построение превью для каждого переданного снимка */
+void VideoView::preview_loop() {
+    while (true) {
+        Model_Video::SnapshotRef snapshot;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv_pending.wait(lock, [this] { return stopping || pending; });
+            if (stopping) {
+                return;
+            }
+            snapshot = std::move(pending);
+        }
+        if (snapshot->frame.empty()) {
+            continue;
+        }
+        make_preview(snapshot->frame);
+        const cv::Size frame_size = snapshot->frame.size();
+        const double frame_fps = snapshot->fps;
+        snapshot.release();
+        std::lock_guard<std::mutex> lock(mtx);
+        std::swap(work, done);
+        done_frame = frame_size;
+        done_fps = frame_fps;
+        ready = true;
+    }
+}
+
+/** Превью кадра в work: уменьшение до размера вида и наложение сетки */
+void VideoView::make_preview(const cv::Mat& frame) {
+    const double k = std::min({ 1.0, static_cast<double>(width) / frame.cols, static_cast<double>(height) / frame.rows });
+    if (k < 1.0) {
+        const cv::Size size(std::max(1, cvRound(frame.cols * k)), std::max(1, cvRound(frame.rows * k)));
+        cv::resize(frame, work, size, 0, 0, cv::INTER_AREA);
+    }
+    else {
+        frame.copyTo(work);
+    }
+
+    if (add_grid) {
+        if (grid_mask.size() != work.size()) {
+            grid_mask.create(work.size(), CV_8U);
+            grid_mask.setTo(0);
+            const int n = 4; 
+            for (int i = 1; i < n; i ++) {
+                cv::line(grid_mask, cv::Point(0, grid_mask.rows * i/n), cv::Point(grid_mask.cols - 1, grid_mask.rows * i/n),
+                    cv::Scalar(255), 1, cv::LineTypes::LINE_4);
+                cv::line(grid_mask, cv::Point(grid_mask.cols * i/n, 0), cv::Point(grid_mask.cols * i/n, grid_mask.rows),
+                    cv::Scalar(255), 1, cv::LineTypes::LINE_4);
+            }
+        }
+        work.setTo(cv::Scalar(0, 100, 200), grid_mask);
+    }
+}
 
 /** Управление режимом отображения спектра*/
 void VideoView::showgrid(bool state) {
@@ -61,14 +149,11 @@ SpectrView::SpectrView(Window& w, int width, int height) :
     auto& yAxis = axes.create<YAxis>();
     axes.create<VerticalGrid>(&xAxis);
     axes.create<HorizontalGrid>(&yAxis);
-    axes.create<CvPlot::Series>("-b").setName("spectr_base");
-  
+    // Графики рисуются поверх кэшированного фона (draw_series), поэтому в axes - только рамка, оси и сетка
     axes.xLabel("nm");
-    axes.yLabel("arb.u");
-    axes.create<VerticalLine>(-1000, "-k").setName("vline");
+    axes.yLabel(bg_label);
+    axes.setXLimAuto(false);
     axes.setYLimAuto(false);
-    axes.setXTight(true);
-    axes.setYTight(true);
 }
 
 
@@ -113,28 +198,22 @@ void SpectrView::mouse_handler(int event, int x, int y, int flags, void* userdat
     }
     else {
         if (event == cv::EVENT_MOUSEMOVE) {
-            auto vline = view.axes.find<VerticalLine>("vline");
-            vline->setPos(mouseEvent.pos().x);
-            auto plot_result = view.axes.render(view.height, view.width);
-            view.window.draw(plot_result);
+            // Курсор рисуется поверх последнего построенного графика без повторной отрисовки
+            if (!view.plot.empty()) {
+                view.plot.copyTo(view.canvas);
+                const int px = view.inner.x + view.to_pixel(mouseEvent.pos().x, 0).x;
+                cv::line(view.canvas, cv::Point(px, view.inner.y), cv::Point(px, view.inner.y + view.inner.height - 1),
+                         cv::Scalar(0, 0, 0), 1);
+                view.window.draw(view.canvas);
+            }
         }
         else if (event == cv::EVENT_LBUTTONUP) {
-            auto vline = view.axes.find<VerticalLine>("vline");
-            vline->setPos(-1000); // способ скрыть линию
-            auto plot_result = view.axes.render(view.height, view.width);
-            view.window.draw(plot_result);
-            if (view.pick_X_callback) {
-                auto data_x_size = view.axes.find<Series>("spectr_base")->getX().size();
-                auto render_x_size = mouseEvent.projection().innerRect().width;
-                auto px = mouseEvent.innerPoint().x;
-                if (px < 0) {
-                    px = 0;
-                }
-                if (px > render_x_size - 1) {
-                    px = render_x_size - 1;
-                }
-                int x_norm = static_cast<int> (px * data_x_size / render_x_size);
-                view.pick_X_callback(x_norm);
+            if (!view.plot.empty()) {
+                view.window.draw(view.plot);
+            }
+            if (view.pick_X_callback && view.shown) {
+                // Шкала X может быть шире основного спектра (треки), поэтому точка спектра ищется по значению на оси
+                view.pick_X_callback(view.nearest_bin(mouseEvent.pos().x));
             }
             view.pick_X_mode = false;
         }
@@ -142,6 +221,27 @@ void SpectrView::mouse_handler(int event, int x, int y, int flags, void* userdat
 }
 
 
+/** Номер точки основного спектра (строка row_nm показанного снимка), ближайшей к значению x на оси */
+int SpectrView::nearest_bin(double x) const {
+    const cv::Mat& data = shown->data;
+    const double* nm = data.ptr<double>(Model_Spectr::row_nm);
+    const int n = data.cols;
+    if (n <= 1) {
+        return 0;
+    }
+    // Шкала монотонна: возрастает или (при обратной калибровке) убывает
+    const bool rising = nm[n - 1] >= nm[0];
+    const int i = static_cast<int>((rising ? std::lower_bound(nm, nm + n, x) : std::lower_bound(nm, nm + n, x, std::greater<>())) - nm);
+    if (i <= 0) {
+        return 0;
+    }
+    if (i >= n) {
+        return n - 1;
+    }
+    return std::abs(nm[i] - x) < std::abs(nm[i - 1] - x) ? i : i - 1;
+}
+
+
 /**
  * Включить режим выбора координаты X c помощью мыши 
  * @param callback Функция обработчик выбранного значения
@@ -153,75 +253,437 @@ void SpectrView::pick_X(std::function<void(int x)> callback) {
     }
 }
 
+/** Включение отображения полосы шума (спектр +/- стандартное отклонение между кадрами) */
+void SpectrView::show_noise(bool state) {
+    noise_band = state;
+}
+
+/** Включение отображения маркеров пиков (Snapshot::peaks) */
+void SpectrView::show_peaks(bool state) {
+    peak_markers = state;
+}
+
+/** Режим отображения относительно сохраненного спектра (MS): спектр, пропускание или оптическая плотность
+ *  Пропускание считается только в этих режимах и только при наличии сохраненного спектра.
+ */
+void SpectrView::set_ratio(ratio_mode mode, const RatioOptions& opt) {
+    ratio = mode;
+    ratio_opt = opt;
+}
+
+/** Дополнительные треки, отображаемые вместе с основным спектром
+ *  Данные треков берутся из их последних снимков при обновлении основного спектра.
+ */
+void SpectrView::set_tracks(const std::vector<TrackSet::Track>& list) {
+    tracks.clear();
+    for (const auto& t : list) {
+        tracks.push_back({ t.model, {} });
+    }
+}
+
 /** Обработка новой порции данных от модели*/
 void SpectrView::on_data_updated(Model& m) {
-    using namespace CvPlot; 
+    if (!is_active) {
+        // Модель спектра обновляется и в режиме водопада
+        return;
+    }
     fps.tick();
-    cv::Mat data = m.get_data();
-    if (data.empty()) {
+    auto& model = dynamic_cast<Model_Spectr&>(m);
+    // Снимок остается закрепленным до следующего обновления: графики могут ссылаться на его данные
+    auto snapshot = model.snapshot();
+    if (!snapshot || snapshot->data.empty()) {
         return;
     }
+    shown = std::move(snapshot);
+    const cv::Mat& data = shown->data;
 
-    const bool have_mem_spectr = data.rows > 2;
+    // В режиме пропускания (оптической плотности) при сохраненном спектре отображается только результат деления
+    const bool ratio_on = ratio != ratio_mode::off && shown->mem;
+    const bool have_mem_spectr = shown->mem && !ratio_on;
+    const bool have_channels = shown->channels && !ratio_on;
+    const bool noise_on = noise_band && !ratio_on;
     auto xData = data.row(Model_Spectr::row_nm);
-    auto yData = data.row(Model_Spectr::row_base);
-    auto ser1 = axes.find<Series>("spectr_base");
-    ser1->setX(xData);
-    ser1->setY(yData);
-
-    // Графики для дополнительных спектров создаются и удалются динамически
-    Series* ser2 = axes.find<Series>("spectr_mem");
-    Series* ser3 = nullptr;
-    //Series* ser3 = axes.find<Series>("spectr_bdm");
-    if (have_mem_spectr && ser2 == nullptr) {
-        axes.create<CvPlot::Series>("-g").setName("spectr_mem").setX(data.row(Model_Spectr::row_nm)).setY(data.row(Model_Spectr::row_mem));
-        mem_spectr_y_limits = calc_limit(data.row(Model_Spectr::row_mem));
-        // axes.create<CvPlot::Series>("--r").setName("spectr_bdm").setX(data.row(Model_Spectr::row_nm)).setY(data.row(Model_Spectr::row_bdm));
-    }
-    // else if (ser3 != nullptr) {
-    //     ser3->setX(data.row(Model_Spectr::row_nm));
-    //     ser3->setY(data.row(Model_Spectr::row_bdm));
-    // }
-    else if (!have_mem_spectr && ( ser2 != nullptr || ser3 != nullptr)) {
-        std::erase_if(axes.drawables(), [ser2, ser3](const std::unique_ptr<Drawable>& drw) {return (drw.get() == ser2 || drw.get()==ser3);});
+    if (ratio_on) {
+        spectr_ratio(data.row(Model_Spectr::row_base), shown->scale, data.row(Model_Spectr::row_mem), shown->mem_scale,
+                     ratio, ratio_opt, ratio_data);
+    }
+    const char* y_label = !ratio_on ? "arb.u" : ratio == ratio_mode::transmittance ? "T" : "A";
+
+    // Спектры по каналам цвета
+    const std::pair<int, cv::Scalar> channel_series[] = {
+        { Model_Spectr::row_red, cv::Scalar(0, 0, 220) },
+        { Model_Spectr::row_green, cv::Scalar(0, 150, 0) },
+        { Model_Spectr::row_blue, cv::Scalar(220, 120, 0) }
+    };
+    // Дополнительные треки (данные из их последних снимков)
+    for (auto& t : tracks) {
+        if (auto s = t.model->snapshot(); s && !s->data.empty()) {
+            t.shown = std::move(s);
+        }
+    }
+
+    // Пирамиды минимумов и максимумов отображаемых спектров (строятся моделью один раз на снимок):
+    // шкала Y и графики строятся по ним за O(ширины графика), а не O(ширины спектра).
+    // Здесь строится только пирамида пропускания (оптической плотности), которой нет в снимке.
+    if (ratio_on) {
+        lod_ratio.build(ratio_data.ptr<double>(), static_cast<int>(ratio_data.total()));
+    }
+    const MinMaxPyramid& lod_base = ratio_on ? lod_ratio : shown->lod[Model_Spectr::row_base];
+    const MinMaxPyramid& lod_mem = shown->lod[Model_Spectr::row_mem];
+    const MinMaxPyramid* lod_noise = shown->lod_noise;
+
+    // Шкала X - по всем отображаемым спектрам (шкала длин волн монотонна - пределы на концах)
+    auto x_range = [](const cv::Mat& x) {
+        const double* p = x.ptr<double>();
+        const double a = p[0], b = p[x.total() - 1];
+        return std::make_pair(std::min(a, b), std::max(a, b));
+    };
+    auto [x_lo, x_hi] = x_range(xData);
+    for (const auto& t : tracks) {
+        if (t.shown && !ratio_on) {
+            const auto [lo, hi] = x_range(t.shown->data.row(Model_Spectr::row_nm));
+            x_lo = std::min(x_lo, lo);
+            x_hi = std::max(x_hi, hi);
+        }
+    }
+    const std::pair<double, double> x_lim{ x_lo, std::max(x_hi, x_lo + 1) };
+    if (axes.getXLim() != x_lim) {
+        axes.setXLim(x_lim);
     }
 
     // Настройка шкалы Y по отображаемым данным
-    auto lim = calc_limit(yData);
-    if (have_mem_spectr) {
-        lim.first = std::min(lim.first, mem_spectr_y_limits.first);
-        lim.second = std::max(lim.second, mem_spectr_y_limits.second);
+    if (ratio_on) {
+        // Пропускание и оптическая плотность - с шагом шкалы 0.1
+        const std::pair<double, double> r_lim{ std::floor(lod_base.min() * 10) / 10, std::ceil(lod_base.max() * 10) / 10 + 0.1 };
+        if (axes.getYLim() != r_lim) {
+            axes.setYLim(r_lim);
+        }
+    }
+    else {
+        auto lim = calc_limit(lod_base);
+        auto extend = [&lim, this](const MinMaxPyramid& lod) {
+            const auto l = calc_limit(lod);
+            lim.first = std::min(lim.first, l.first);
+            lim.second = std::max(lim.second, l.second);
+        };
+        for (const auto& t : tracks) {
+            if (t.shown) {
+                extend(t.shown->lod[Model_Spectr::row_base]);
+            }
+        }
+        if (have_channels) {
+            for (const auto& series : channel_series) {
+                extend(shown->lod[series.first]);
+            }
+        }
+        if (noise_on) {
+            extend(lod_noise[0]);
+            extend(lod_noise[1]);
+        }
+        if (have_mem_spectr) {
+            extend(lod_mem);
+        };
+        if (abs(axes.getYLim().first - lim.first) > Y_LIM_STEP / 2 ||
+             abs(axes.getYLim().second - lim.second) > Y_LIM_STEP / 2) {
+            axes.setYLim(lim);
+        }
+    }
+    update_background(y_label);
+
+    // Графики поверх фона
+    background.copyTo(plot);
+    if (have_channels) {
+        for (int c = 0; c < 3; c++) {
+            draw_series(xData, shown->lod[channel_series[c].first], channel_series[c].second);
+        }
+    }
+    if (noise_on) {
+        draw_series(xData, lod_noise[0], cv::Scalar(200, 170, 150));
+        draw_series(xData, lod_noise[1], cv::Scalar(200, 170, 150));
+    }
+    static const cv::Scalar track_colors[] = {
+        cv::Scalar(160, 0, 160), cv::Scalar(0, 140, 200), cv::Scalar(120, 120, 0), cv::Scalar(80, 80, 80)
     };
-    if (abs(axes.getYLim().first - lim.first) > Y_LIM_STEP / 2 ||
-         abs(axes.getYLim().second - lim.second) > Y_LIM_STEP / 2) {
-        axes.setYLim(lim);
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks[i].shown && !ratio_on) {
+            draw_series(tracks[i].shown->data.row(Model_Spectr::row_nm), tracks[i].shown->lod[Model_Spectr::row_base],
+                        track_colors[i % std::size(track_colors)]);
+        }
+    }
+    if (have_mem_spectr) {
+        draw_series(xData, lod_mem, cv::Scalar(0, 160, 0));
     }
+    draw_series(xData, lod_base, cv::Scalar(255, 0, 0));
 
-    // Отображение полотна
-    cv::Mat plot_result = axes.render(height, width);
-    window.draw(plot_result);
+    // Маркеры пиков в вершинах уточненных пиков
+    if (peak_markers && !ratio_on) {
+        cv::Mat inner_plot = plot(inner);
+        for (const auto& p : shown->peaks) {
+            cv::circle(inner_plot, to_pixel(p.nm, p.height), 4, cv::Scalar(0, 0, 255), 1, cv::LINE_AA);
+        }
+    }
+    window.draw(plot);
 
     // Отображение строки состояния
     if (is_active) {
+        status.clear();
         if (mouse_pos_y != -1) {
-            std::string str = fmt::format("({} nm, {} arb.u) | FPS: {:.1f}", mouse_pos_x, mouse_pos_y, fps.fps());
-            cv::displayStatusBar(window.name(), str, 0);
+            fmt::format_to(std::back_inserter(status), "({} nm, {} arb.u) | ", mouse_pos_x, mouse_pos_y);
         }
-        else {
-            std::string str = fmt::format("FPS: {:.1f}", fps.fps());
-            cv::displayStatusBar(window.name(), str, 0);
+        append_render_stat(status, shown->fps);
+        if (peak_markers) {
+            fmt::format_to(std::back_inserter(status), " | Peaks: {}", shown->peaks.size());
+            // Ближайший к курсору пик
+            const Peak* near = nullptr;
+            for (const auto& p : shown->peaks) {
+                if (near == nullptr || std::abs(p.nm - mouse_pos_x) < std::abs(near->nm - mouse_pos_x)) {
+                    near = &p;
+                }
+            }
+            if (near != nullptr && mouse_pos_y != -1) {
+                fmt::format_to(std::back_inserter(status), " | #{} {:.2f} nm, FWHM {:.1f} px", near->id, near->nm, near->fwhm);
+            }
+        }
+        // Наиболее похожие эталоны библиотеки
+        for (size_t i = 0; i < shown->matches.size(); i++) {
+            const auto& m = shown->matches[i];
+            fmt::format_to(std::back_inserter(status), "{}{} {:.3f}", i == 0 ? " | Match: " : ", ", *m.name, m.score);
         }
+        cv::displayStatusBar(window.name(), status, 0);
     }
 }
 
 
+/** Построение фона (рамка, оси, сетка, подписи) при изменении пределов шкал или подписи оси Y
+ *  Фон кэшируется в background; вместе с ним запоминается линейное преобразование координат данных
+ *  в пиксели внутренней области графика для draw_series() и курсора.
+ */
+void SpectrView::update_background(const char* y_label) {
+    const auto x_lim = axes.getXLim();
+    const auto y_lim = axes.getYLim();
+    if (!background.empty() && x_lim == bg_xlim && y_lim == bg_ylim && y_label == bg_label) {
+        return;
+    }
+    if (y_label != bg_label) {
+        axes.yLabel(y_label);
+        bg_label = y_label;
+    }
+    bg_xlim = x_lim;
+    bg_ylim = y_lim;
+    axes.render(background, cv::Size(width, height));
+    const auto projection = axes.getProjection(cv::Size(width, height));
+    inner = projection.innerRect() & cv::Rect(0, 0, width, height);
+    const cv::Point2d p0 = projection.project(cv::Point2d(x_lim.first, y_lim.first));
+    const cv::Point2d p1 = projection.project(cv::Point2d(x_lim.second, y_lim.second));
+    kx = (p1.x - p0.x) / (x_lim.second - x_lim.first);
+    bx = p0.x - kx * x_lim.first - inner.x;
+    ky = (p1.y - p0.y) / (y_lim.second - y_lim.first);
+    by = p0.y - ky * y_lim.first - inner.y;
+}
+
+/** Пиксель внутренней области графика для точки данных */
+cv::Point SpectrView::to_pixel(double x, double y) const {
+    // Ограничение координат исключает переполнение при значениях далеко за пределами шкалы
+    return cv::Point(static_cast<int>(std::clamp(kx * x + bx, -1e6, 1e6)), static_cast<int>(std::clamp(ky * y + by, -1e6, 1e6)));
+}
+
+/** Рисование графика во внутренней области поверх фона
+ *  Если точек больше удвоенного количества столбцов графика, каждый столбец рисуется отрезком
+ *  от минимума до максимума попавших в него точек (по пирамиде lod), иначе - ломаной по всем точкам.
+ *  Точки относятся к столбцам по их координате x на графике (column_ranges), а не по номеру,
+ *  поэтому нелинейная шкала длин волн и шкала, не занимающая всю ширину графика, прореживаются верно.
+ * @param x шкала (строка CV_64F, монотонная)
+ * @param lod пирамида значений той же длины
+ */
+void SpectrView::draw_series(const cv::Mat& x, const MinMaxPyramid& lod, const cv::Scalar& color) {
+    const int n = std::min(static_cast<int>(x.total()), lod.size());
+    const int cols = inner.width;
+    const double* px = x.ptr<double>();
+    if (n <= 2 * cols) {
+        line_pts.resize(n);
+        for (int i = 0; i < n; i++) {
+            line_pts[i] = to_pixel(px[i], lod[i]);
+        }
+    }
+    else {
+        // Столбец c внутренней области - координаты x от (c - bx) / kx до (c + 1 - bx) / kx
+        column_ranges(px, n, -bx / kx, 1 / kx, cols, columns);
+        // Вершины идут зигзагом (минимум-максимум, максимум-минимум), чтобы соседние столбцы соединялись вертикально
+        line_pts.clear();
+        for (int c = 0; c < cols; c++) {
+            const auto [i0, i1] = columns[c];
+            if (i0 >= i1) {
+                continue;
+            }
+            double lo, hi;
+            lod.range(i0, i1, lo, hi);
+            const bool even = line_pts.size() % 4 == 0;
+            line_pts.push_back(cv::Point(c, to_pixel(0, even ? lo : hi).y));
+            line_pts.push_back(cv::Point(c, to_pixel(0, even ? hi : lo).y));
+        }
+    }
+    cv::Mat inner_plot = plot(inner);
+    cv::polylines(inner_plot, line_pts, false, color, 1, cv::LINE_AA);
+}
+
+
 /** Возвращает значения мнимального и максимального занчения для шкалы Y, чтобы вместить график
- * @param yData Матрица с одной строкой (значения координаты y)
+ * @param lod пирамида значений графика (используются только общие минимум и максимум)
   */
-std::pair<double, double> SpectrView::calc_limit(const cv::Mat &yData) {
-    std::pair<double, double> lim{ *std::min_element(yData.begin<double>(), yData.end<double>()) - Y_LIM_STEP / 2 ,
-                                   *std::max_element(yData.begin<double>(), yData.end<double>()) + Y_LIM_STEP / 2 };
+std::pair<double, double> SpectrView::calc_limit(const MinMaxPyramid& lod) {
+    std::pair<double, double> lim{ lod.min() - Y_LIM_STEP / 2, lod.max() + Y_LIM_STEP / 2 };
     lim.first = (int(lim.first) / Y_LIM_STEP) * Y_LIM_STEP;
     lim.second = (int(lim.second) / Y_LIM_STEP + 1) * Y_LIM_STEP;
     return lim;
-}
\ No newline at end of file
+}
+
+
+/*---------------------------- WaterfallView -------------------------------------*/
+
+/** Конструктор
+ * @param w - Объект окна Window, на котором работает вид
+ * @param width - Ширина окна (точек спектра в строке)
+ * @param height - Высота окна (отображаемых спектров)
+ */
+WaterfallView::WaterfallView(Window& w, int width, int height) :
+    View(w), width(width), height(height),
+    ring(height, width, CV_8UC3, cv::Scalar::all(0)), ring_time(height, 0.0),
+    canvas(height, width, CV_8UC3), scaled(width) {
+    cv::Mat ramp(1, 256, CV_8U), colors;
+    for (int i = 0; i < 256; i++) {
+        ramp.at<uint8_t>(i) = static_cast<uint8_t>(i);
+    }
+    cv::applyColorMap(ramp, colors, cv::COLORMAP_INFERNO);
+    for (int i = 0; i < 256; i++) {
+        palette[i] = colors.at<cv::Vec3b>(i);
+    }
+}
+
+/** При активации изображение строится заново по всей доступной истории */
+void WaterfallView::activate() {
+    View::activate();
+    clear();
+}
+
+/** Очистка кольца: следующее обновление растеризует последние height строк истории */
+void WaterfallView::clear() {
+    ring.setTo(cv::Scalar::all(0));
+    head = 0;
+    filled = 0;
+    next_index = 0;
+    range_set = false;
+}
+
+/** Шкала строк: столбцы вида делят ее диапазон на равные части (по длине волны, если шкала калибрована)
+ *  Точки строки распределяются по столбцам заново только при изменении шкалы.
+ * @param x шкала (монотонная), n точек
+ */
+void WaterfallView::set_scale(const double* x, int n) {
+    if (static_cast<int>(scale_x.size()) == n && std::equal(x, x + n, scale_x.begin())) {
+        return;
+    }
+    scale_x.assign(x, x + n);
+    if (n == 0) {
+        return;
+    }
+    const double x0 = std::min(x[0], x[n - 1]);
+    const double dx = n > 1 ? (std::max(x[0], x[n - 1]) - x0) / width : 1.0;
+    column_ranges(x, n, x0, dx, width, columns);
+    column_f.assign(width, 0.F);
+    for (int c = 0; c < width; c++) {
+        const int k = columns[c].first;
+        if (columns[c].second == k && k > 0 && k < n) {
+            column_f[c] = static_cast<float>((x0 + (c + 0.5) * dx - x[k - 1]) / (x[k] - x[k - 1]));
+        }
+    }
+}
+
+/** Растеризация спектра в новую верхнюю строку кольца */
+void WaterfallView::draw_row(const std::vector<float>& y) {
+    const int n = static_cast<int>(y.size());
+    if (n != static_cast<int>(scale_x.size())) {
+        // Строка другой ширины (до смены окна): шкала - номера точек
+        index_x.resize(n);
+        for (int i = 0; i < n; i++) {
+            index_x[i] = i;
+        }
+        set_scale(index_x.data(), n);
+    }
+    // Приведение к ширине вида: при сжатии - максимум по столбцу (узкие линии не пропадают),
+    // при растяжении (в столбец не попало ни одной точки) - линейная интерполяция
+    for (int x = 0; x < width; x++) {
+        const auto [i0, i1] = columns[x];
+        if (i1 > i0) {
+            scaled[x] = *std::max_element(y.begin() + i0, y.begin() + i1);
+        }
+        else if (i0 == 0 || i0 >= n) {
+            scaled[x] = y[std::min(i0, n - 1)];
+        }
+        else {
+            scaled[x] = y[i0 - 1] + (y[i0] - y[i0 - 1]) * column_f[x];
+        }
+    }
+    const auto [rmin, rmax] = std::minmax_element(scaled.begin(), scaled.end());
+    if (!range_set) {
+        lo = *rmin;
+        hi = *rmax;
+        range_set = true;
+    }
+    else {
+        lo = std::min(*rmin, lo + (*rmin - lo) * RANGE_DECAY);
+        hi = std::max(*rmax, hi - (hi - *rmax) * RANGE_DECAY);
+    }
+    const float k = hi > lo ? 255.F / (hi - lo) : 0.F;
+
+    head = (head + height - 1) % height;
+    filled = std::min(filled + 1, height);
+    auto dst = ring.ptr<cv::Vec3b>(head);
+    for (int x = 0; x < width; x++) {
+        dst[x] = palette[static_cast<int>(std::clamp((scaled[x] - lo) * k, 0.F, 255.F))];
+    }
+}
+
+/** Обработка новой порции данных от модели: растеризация новых строк истории и вывод */
+void WaterfallView::on_data_updated(Model& m) {
+    if (!is_active) {
+        return;
+    }
+    fps.tick();
+    auto& model = dynamic_cast<Model_Spectr&>(m);
+    double processing_fps = 0;
+    if (auto snapshot = model.snapshot(); snapshot && !snapshot->data.empty()) {
+        set_scale(snapshot->data.ptr<double>(Model_Spectr::row_nm), snapshot->data.cols);
+        processing_fps = snapshot->fps;
+    }
+    const auto& history = model.get_history();
+    if (history.generation() != generation) {
+        generation = history.generation();
+        clear();
+    }
+    const uint64_t count = history.count();
+    // Строки, вытесненные из истории или не помещающиеся в вид, не растеризуются
+    const uint64_t keep = static_cast<uint64_t>(std::min(height, history.capacity()));
+    const uint64_t first = std::max(next_index, count > keep ? count - keep : 0);
+    for (uint64_t i = first; i < count; i++) {
+        double t = 0;
+        if (history.read(i, row, &t) && !row.empty()) {
+            draw_row(row);
+            ring_time[head] = t;
+        }
+    }
+    next_index = std::max(next_index, count);
+
+    // Сборка изображения: от самой новой строки кольца (head) до конца, затем начало кольца
+    ring.rowRange(head, height).copyTo(canvas.rowRange(0, height - head));
+    if (head > 0) {
+        ring.rowRange(0, head).copyTo(canvas.rowRange(height - head, height));
+    }
+    window.draw(canvas);
+
+    status.clear();
+    const double span = filled > 1 ? ring_time[head] - ring_time[(head + filled - 1) % height] : 0.0;
+    fmt::format_to(std::back_inserter(status), "Waterfall: {} spectra, {:.0f} s | Range: {:.0f}...{:.0f} | ",
+                   filled, span, lo, hi);
+    append_render_stat(status, processing_fps);
+    cv::displayStatusBar(window.name(), status, 0);
+}
@@ -115,6 +115,14 @@ void MainWindow::create_controls(){
         }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR
     );
 
+    cv::createButton("Водопад",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->set_mode(Controller::mode::waterfall);
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON
+    );
+
     cv::createButton("MS", 
         []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
@@ -131,6 +139,46 @@ void MainWindow::create_controls(){
         }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON 
     );
 
+    cv::createButton("MR",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->spectr_memrecall();
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON
+    );
+
+    // Отображение относительно сохраненного спектра: сигнал, пропускание, оптическая плотность
+    struct RatioButton {
+        const char* name;
+        ratio_mode mode;
+        Controller* ctrl;
+    };
+    static RatioButton ratio_modes[] = {
+        { "Сигнал", ratio_mode::off, nullptr },
+        { "Пропускание", ratio_mode::transmittance, nullptr },
+        { "Оптич. плотность", ratio_mode::absorbance, nullptr }
+    };
+    for (auto& b : ratio_modes) {
+        b.ctrl = ptr_ctrl;
+        cv::createButton(b.name,
+            [](int state, void* pbutton) {
+                auto button = static_cast<RatioButton*>(pbutton);
+                if (state && button->ctrl) {
+                    button->ctrl->set_ratio(button->mode);
+                };
+            }, static_cast<void*>(&b), cv::QT_RADIOBOX,
+            ptr_ctrl->opt.spectr_ratio_mode == static_cast<int>(b.mode)
+        );
+    }
+
+    cv::createButton("RGB",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->show_channels(state);
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_CHECKBOX, ptr_ctrl->opt.show_channels
+    );
+
     cv::createButton("Экспорт спектра...", 
         []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
@@ -139,7 +187,18 @@ void MainWindow::create_controls(){
         }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR 
     );
 
-    cv::createTrackbar("Кадры накопления", std::string(), &ptr_ctrl->opt.spectr_acc_fps, 10,
+    cv::createButton("Экспорт истории...",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->export_history();
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON
+    );
+
+    // Интервал чтения из хранилища спектров (MR и экспорт истории), минут назад
+    cv::createTrackbar("История, мин", std::string(), &ptr_ctrl->opt.recall_minutes, ptr_ctrl->glob_opt.recall_max);
+
+    cv::createTrackbar("Кадры накопления", std::string(), &ptr_ctrl->opt.spectr_acc_fps, ptr_ctrl->glob_opt.acc_frames_max,
         [](int val, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
                 p->set_spectr_fps(val);
@@ -147,35 +206,104 @@ void MainWindow::create_controls(){
         }, static_cast<void*>(ptr_ctrl)
     );
 
-    cv::createButton("Калибровка (сброс)", 
+    // Режимы накопления: сумма блока кадров, скользящее среднее, экспоненциальное среднее
+    struct AccModeButton {
+        const char* name;
+        Model_Spectr::accumulation mode;
+        Controller* ctrl;
+    };
+    static AccModeButton acc_modes[] = {
+        { "Блок", Model_Spectr::accumulation::block, nullptr },
+        { "Скользящее", Model_Spectr::accumulation::sliding, nullptr },
+        { "EMA", Model_Spectr::accumulation::ema, nullptr }
+    };
+    for (auto& b : acc_modes) {
+        b.ctrl = ptr_ctrl;
+        cv::createButton(b.name,
+            [](int state, void* pbutton) {
+                auto button = static_cast<AccModeButton*>(pbutton);
+                if (state && button->ctrl) {
+                    button->ctrl->set_accumulation(button->mode);
+                };
+            }, static_cast<void*>(&b), cv::QT_RADIOBOX | (&b == acc_modes ? cv::QT_NEW_BUTTONBAR : 0),
+            ptr_ctrl->opt.spectr_acc_mode == static_cast<int>(b.mode)
+        );
+    }
+
+    cv::createButton("Шум",
         []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
-                p->reset_calibration() ;
+                p->show_noise(state);
             };
-        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR 
+        }, static_cast<void*>(ptr_ctrl), cv::QT_CHECKBOX, ptr_ctrl->opt.show_noise
     );
-    
-    if (ptr_ctrl->glob_opt.calib_v[0] > 0) {
-        cv::createButton(std::to_string(ptr_ctrl->glob_opt.calib_v[0])+" нм", []([[maybe_unused]]int state, void* pctrl) {
+
+    cv::createButton("Пики",
+        []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
-                p->calibrate(1);
+                p->show_peaks(state);
             };
-        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR );
-    }
+        }, static_cast<void*>(ptr_ctrl), cv::QT_CHECKBOX, ptr_ctrl->opt.show_peaks
+    );
 
-    if (ptr_ctrl->glob_opt.calib_v[1] > 0) {
-        cv::createButton(std::to_string(ptr_ctrl->glob_opt.calib_v[1])+" нм", []([[maybe_unused]]int state, void* pctrl) {
+    cv::createButton("Темновой кадр",
+        []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
-                p->calibrate(2);
+                p->capture_reference(true);
             };
-        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON );
-    }
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR
+    );
+
+    cv::createButton("Плоское поле",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->capture_reference(false);
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON
+    );
+
+    cv::createButton("Коррекция",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->set_correction(state);
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_CHECKBOX, ptr_ctrl->opt.correction
+    );
+
+    cv::createButton("Сброс коррекции",
+        []([[maybe_unused]]int state, void* pctrl) {
+            if (auto p = static_cast<Controller*>(pctrl)) {
+                p->reset_correction();
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON
+    );
 
-    if (ptr_ctrl->glob_opt.calib_v[2] > 0) {
-        cv::createButton(std::to_string(ptr_ctrl->glob_opt.calib_v[2])+" нм", []([[maybe_unused]]int state, void* pctrl) {
+    cv::createButton("Калибровка (сброс)", 
+        []([[maybe_unused]]int state, void* pctrl) {
             if (auto p = static_cast<Controller*>(pctrl)) {
-                p->calibrate(3);
+                p->reset_calibration() ;
+            };
+        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON | cv::QT_NEW_BUTTONBAR 
+    );
+    
+    // Кнопки точек калибровки (длины волн CALIB_L1, CALIB_L2, ... из конфигурации)
+    struct CalibButton {
+        int n;
+        Controller* ctrl;
+    };
+    static CalibButton calib_buttons[Controller::CALIB_POINTS_MAX];
+    bool first_calib = true;
+    for (int i = 0; i < Controller::CALIB_POINTS_MAX; i++) {
+        if (ptr_ctrl->glob_opt.calib_v[i] <= 0) {
+            continue;
+        }
+        calib_buttons[i] = { i + 1, ptr_ctrl };
+        cv::createButton(std::to_string(ptr_ctrl->glob_opt.calib_v[i])+" нм", []([[maybe_unused]]int state, void* pbutton) {
+            auto button = static_cast<CalibButton*>(pbutton);
+            if (button->ctrl) {
+                button->ctrl->calibrate(button->n);
             };
-        }, static_cast<void*>(ptr_ctrl), cv::QT_PUSH_BUTTON );
+        }, static_cast<void*>(&calib_buttons[i]), cv::QT_PUSH_BUTTON | (first_calib ? cv::QT_NEW_BUTTONBAR : 0));
+        first_calib = false;
     }
 }
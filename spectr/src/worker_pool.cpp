@@ -0,0 +1,82 @@
+/**
+ * @file worker_pool.cpp
+ * @author Sergey Simonov (sb.simonov@gmail.com)
+ * @brief Реализация пула рабочих потоков
+ */
+
+#include <algorithm>
+#include "worker_pool.h"
+
+/** Создает пул
+ * @param threads общее количество потоков, включая вызывающий; 0 - по количеству ядер процессора
+ */
+WorkerPool::WorkerPool(int threads) {
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(&WorkerPool::worker_loop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+/** Выполняет задачи [0, tasks) на всех потоках пула, дожидается их завершения */
+void WorkerPool::run_tasks(int tasks, task_fn fn, void* ctx) {
+    if (workers.empty() || tasks <= 1) {
+        for (int i = 0; i < tasks; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job_fn = fn;
+        job_ctx = ctx;
+        job_tasks = tasks;
+        next_task = 0;
+        busy = static_cast<int>(workers.size());
+        generation++;
+    }
+    start_cv.notify_all();
+    execute();
+    std::unique_lock<std::mutex> lock(mtx);
+    done_cv.wait(lock, [this] { return busy == 0; });
+}
+
+/** Выбирает и выполняет задачи текущего задания, пока они не закончатся */
+void WorkerPool::execute() {
+    for (int i = next_task++; i < job_tasks; i = next_task++) {
+        job_fn(job_ctx, i);
+    }
+}
+
+/** Рабочий цикл потока пула */
+void WorkerPool::worker_loop() {
+    uint64_t done_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            start_cv.wait(lock, [&] { return stopping || generation != done_generation; });
+            if (stopping) {
+                return;
+            }
+            done_generation = generation;
+        }
+        execute();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            busy--;
+        }
+        done_cv.notify_one();
+    }
+}